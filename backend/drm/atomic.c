@@ -105,6 +105,9 @@ static void atomic_add(struct atomic *atom, uint32_t id, uint32_t prop, uint64_t
 	}
 }
 
+// Damage clips blobs with more rectangles aren't cached
+#define FB_DAMAGE_CLIPS_CACHE_MAX_RECTS 4
+
 static bool create_mode_blob(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state, uint32_t *blob_id) {
 	if (!state->active) {
@@ -112,7 +115,7 @@ static bool create_mode_blob(struct wlr_drm_connector *conn,
 		return true;
 	}
 
-	if (drmModeCreatePropertyBlob(conn->backend->fd, &state->mode,
+	if (!drm_blob_cache_acquire(conn->backend, &state->mode,
 			sizeof(drmModeModeInfo), blob_id)) {
 		wlr_log_errno(WLR_ERROR, "Unable to create mode property blob");
 		return false;
@@ -143,8 +146,7 @@ static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
 		gamma[i].blue = b[i];
 	}
 
-	if (drmModeCreatePropertyBlob(drm->fd, gamma,
-			size * sizeof(*gamma), blob_id) != 0) {
+	if (!drm_blob_cache_acquire(drm, gamma, size * sizeof(*gamma), blob_id)) {
 		wlr_log_errno(WLR_ERROR, "Unable to create gamma LUT property blob");
 		free(gamma);
 		return false;
@@ -163,15 +165,19 @@ bool create_fb_damage_clips_blob(struct wlr_drm_backend *drm,
 	int rects_len;
 	const pixman_box32_t *rects = pixman_region32_rectangles(&clipped, &rects_len);
 
-	int ret;
-	if (rects_len > 0) {
-		ret = drmModeCreatePropertyBlob(drm->fd, rects, sizeof(*rects) * rects_len, blob_id);
+	// Small damage is often identical from one frame to the next (e.g. a
+	// blinking cursor or a full-screen video), larger damage rarely is
+	bool ok = true;
+	if (rects_len > FB_DAMAGE_CLIPS_CACHE_MAX_RECTS) {
+		ok = drmModeCreatePropertyBlob(drm->fd, rects,
+			sizeof(*rects) * rects_len, blob_id) == 0;
+	} else if (rects_len > 0) {
+		ok = drm_blob_cache_acquire(drm, rects, sizeof(*rects) * rects_len, blob_id);
 	} else {
-		ret = 0;
 		*blob_id = 0;
 	}
 	pixman_region32_fini(&clipped);
-	if (ret != 0) {
+	if (!ok) {
 		wlr_log_errno(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
 		return false;
 	}
@@ -213,21 +219,12 @@ static uint64_t pick_max_bpc(struct wlr_drm_connector *conn, struct wlr_drm_fb *
 	return target_bpc;
 }
 
-static void destroy_blob(struct wlr_drm_backend *drm, uint32_t id) {
-	if (id == 0) {
-		return;
-	}
-	if (drmModeDestroyPropertyBlob(drm->fd, id) != 0) {
-		wlr_log_errno(WLR_ERROR, "Failed to destroy blob");
-	}
-}
-
 static void commit_blob(struct wlr_drm_backend *drm,
 		uint32_t *current, uint32_t next) {
 	if (*current == next) {
 		return;
 	}
-	destroy_blob(drm, *current);
+	drm_blob_cache_release(drm, *current);
 	*current = next;
 }
 
@@ -236,7 +233,7 @@ static void rollback_blob(struct wlr_drm_backend *drm,
 	if (*current == next) {
 		return;
 	}
-	destroy_blob(drm, next);
+	drm_blob_cache_release(drm, next);
 }
 
 bool drm_atomic_connector_prepare(struct wlr_drm_connector_state *state, bool modeset) {
@@ -250,6 +247,11 @@ bool drm_atomic_connector_prepare(struct wlr_drm_connector_state *state, bool mo
 		if (!create_mode_blob(conn, state, &mode_id)) {
 			return false;
 		}
+		// The blob is shared with the current state, which holds a reference
+		// already
+		if (mode_id != 0 && mode_id == crtc->mode_id && crtc->own_mode_id) {
+			drm_blob_cache_release(drm, mode_id);
+		}
 	}
 
 	uint32_t gamma_lut = crtc->gamma_lut;
@@ -268,6 +270,9 @@ bool drm_atomic_connector_prepare(struct wlr_drm_connector_state *state, bool mo
 					state->base->gamma_lut, &gamma_lut)) {
 				return false;
 			}
+			if (gamma_lut != 0 && gamma_lut == crtc->gamma_lut) {
+				drm_blob_cache_release(drm, gamma_lut);
+			}
 		}
 	}
 
@@ -320,7 +325,7 @@ void drm_atomic_connector_apply_commit(struct wlr_drm_connector_state *state) {
 	conn->output.adaptive_sync_status = state->vrr_enabled ?
 		WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED : WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
 
-	destroy_blob(drm, state->fb_damage_clips);
+	drm_blob_cache_release(drm, state->fb_damage_clips);
 	if (state->primary_in_fence_fd >= 0) {
 		close(state->primary_in_fence_fd);
 	}
@@ -340,7 +345,7 @@ void drm_atomic_connector_rollback_commit(struct wlr_drm_connector_state *state)
 	rollback_blob(drm, &crtc->mode_id, state->mode_id);
 	rollback_blob(drm, &crtc->gamma_lut, state->gamma_lut);
 
-	destroy_blob(drm, state->fb_damage_clips);
+	drm_blob_cache_release(drm, state->fb_damage_clips);
 	if (state->primary_in_fence_fd >= 0) {
 		close(state->primary_in_fence_fd);
 	}
@@ -489,6 +494,17 @@ static bool atomic_device_commit(struct wlr_drm_backend *drm,
 		struct wlr_drm_page_flip *page_flip, uint32_t flags, bool test_only) {
 	bool ok = false;
 
+	// The same configurations tend to be tested on every frame, skip the
+	// ioctl if we already know the result
+	struct wl_array cache_key;
+	wl_array_init(&cache_key);
+	bool cacheable = test_only && drm->test_cache.enabled &&
+		drm_test_cache_build_key(&cache_key, drm, state, flags);
+	if (cacheable && drm_test_cache_lookup(&drm->test_cache, &cache_key, &ok)) {
+		wl_array_release(&cache_key);
+		return ok;
+	}
+
 	for (size_t i = 0; i < state->connectors_len; i++) {
 		if (!drm_atomic_connector_prepare(&state->connectors[i], state->modeset)) {
 			goto out;
@@ -515,7 +531,15 @@ static bool atomic_device_commit(struct wlr_drm_backend *drm,
 	ok = atomic_commit(&atom, drm, state, page_flip, flags);
 	atomic_finish(&atom);
 
+	if (cacheable) {
+		drm_test_cache_insert(&drm->test_cache, &cache_key, ok);
+	} else if (!test_only && (!ok || state->modeset)) {
+		// The hardware state has changed, or our view of it is wrong
+		drm_test_cache_clear(&drm->test_cache);
+	}
+
 out:
+	wl_array_release(&cache_key);
 	for (size_t i = 0; i < state->connectors_len; i++) {
 		struct wlr_drm_connector_state *conn_state = &state->connectors[i];
 		if (ok && !test_only) {
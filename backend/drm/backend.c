@@ -60,6 +60,8 @@ static void backend_destroy(struct wlr_backend *backend) {
 	}
 
 	finish_drm_resources(drm);
+	drm_test_cache_finish(&drm->test_cache);
+	drm_blob_cache_finish(&drm->blob_cache, drm);
 
 	struct wlr_drm_fb *fb, *fb_tmp;
 	wl_list_for_each_safe(fb, fb_tmp, &drm->fbs, link) {
@@ -106,6 +108,15 @@ struct wlr_backend *wlr_drm_backend_get_parent(struct wlr_backend *backend) {
 	return drm->parent ? &drm->parent->backend : NULL;
 }
 
+void wlr_drm_backend_get_test_cache_stats(struct wlr_backend *backend,
+		struct wlr_drm_test_cache_stats *stats) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	*stats = (struct wlr_drm_test_cache_stats){
+		.hits = drm->test_cache.hits,
+		.misses = drm->test_cache.misses,
+	};
+}
+
 static void handle_session_active(struct wl_listener *listener, void *data) {
 	struct wlr_drm_backend *drm =
 		wl_container_of(listener, drm, session_active);
@@ -113,6 +124,9 @@ static void handle_session_active(struct wl_listener *listener, void *data) {
 
 	wlr_log(WLR_INFO, "DRM FD %s", session->active ? "resumed" : "paused");
 
+	// Another DRM master may have changed the KMS state
+	drm_test_cache_clear(&drm->test_cache);
+
 	if (!session->active) {
 		// Disconnect any active connectors so that the client will modeset and
 		// rerender when the session is activated again.
@@ -139,10 +153,12 @@ static void handle_dev_change(struct wl_listener *listener, void *data) {
 	switch (change->type) {
 	case WLR_DEVICE_HOTPLUG:
 		wlr_log(WLR_DEBUG, "Received hotplug event for %s", drm->name);
+		drm_test_cache_clear(&drm->test_cache);
 		scan_drm_connectors(drm, &change->hotplug);
 		break;
 	case WLR_DEVICE_LEASE:
 		wlr_log(WLR_DEBUG, "Received lease event for %s", drm->name);
+		drm_test_cache_clear(&drm->test_cache);
 		scan_drm_leases(drm);
 		break;
 	default:
@@ -240,6 +256,8 @@ struct wlr_backend *wlr_drm_backend_create(struct wlr_session *session,
 	wl_list_init(&drm->fbs);
 	wl_list_init(&drm->connectors);
 	wl_list_init(&drm->page_flips);
+	drm_test_cache_init(&drm->test_cache);
+	drm_blob_cache_init(&drm->blob_cache);
 
 	drm->dev = dev;
 	drm->fd = dev->fd;
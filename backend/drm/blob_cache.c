@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include <xf86drmMode.h>
+#include "backend/drm/blob_cache.h"
+#include "backend/drm/drm.h"
+#include "util/hash.h"
+
+// Upper bound on cached blobs without any reference
+#define BLOB_CACHE_MAX_ENTRIES 32
+
+struct wlr_drm_blob_cache_entry {
+	struct wl_list link; // wlr_drm_blob_cache.entries
+	uint32_t id;
+	size_t refs;
+	uint64_t hash;
+	void *data;
+	size_t size;
+};
+
+static void destroy_blob(struct wlr_drm_backend *drm, uint32_t id) {
+	if (drmModeDestroyPropertyBlob(drm->fd, id) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to destroy blob");
+	}
+}
+
+static void entry_destroy(struct wlr_drm_blob_cache *cache,
+		struct wlr_drm_backend *drm, struct wlr_drm_blob_cache_entry *entry) {
+	destroy_blob(drm, entry->id);
+	wl_list_remove(&entry->link);
+	cache->entries_len--;
+	free(entry->data);
+	free(entry);
+}
+
+void drm_blob_cache_init(struct wlr_drm_blob_cache *cache) {
+	*cache = (struct wlr_drm_blob_cache){0};
+	wl_list_init(&cache->entries);
+}
+
+void drm_blob_cache_finish(struct wlr_drm_blob_cache *cache,
+		struct wlr_drm_backend *drm) {
+	struct wlr_drm_blob_cache_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &cache->entries, link) {
+		entry_destroy(cache, drm, entry);
+	}
+}
+
+static void evict_unused(struct wlr_drm_blob_cache *cache,
+		struct wlr_drm_backend *drm) {
+	struct wlr_drm_blob_cache_entry *entry, *tmp;
+	wl_list_for_each_reverse_safe(entry, tmp, &cache->entries, link) {
+		if (cache->entries_len <= BLOB_CACHE_MAX_ENTRIES) {
+			break;
+		}
+		if (entry->refs == 0) {
+			entry_destroy(cache, drm, entry);
+		}
+	}
+}
+
+bool drm_blob_cache_acquire(struct wlr_drm_backend *drm,
+		const void *data, size_t size, uint32_t *blob_id) {
+	struct wlr_drm_blob_cache *cache = &drm->blob_cache;
+	uint64_t hash = hash_fnv1a(data, size);
+
+	struct wlr_drm_blob_cache_entry *entry;
+	wl_list_for_each(entry, &cache->entries, link) {
+		if (entry->hash == hash && entry->size == size &&
+				memcmp(entry->data, data, size) == 0) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&cache->entries, &entry->link);
+			entry->refs++;
+			*blob_id = entry->id;
+			return true;
+		}
+	}
+
+	uint32_t id;
+	if (drmModeCreatePropertyBlob(drm->fd, data, size, &id) != 0) {
+		return false;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	void *copy = malloc(size);
+	if (entry == NULL || copy == NULL) {
+		// The blob can still be used, it just won't be shared
+		free(entry);
+		free(copy);
+		*blob_id = id;
+		return true;
+	}
+	memcpy(copy, data, size);
+
+	entry->id = id;
+	entry->refs = 1;
+	entry->hash = hash;
+	entry->data = copy;
+	entry->size = size;
+	wl_list_insert(&cache->entries, &entry->link);
+	cache->entries_len++;
+
+	evict_unused(cache, drm);
+
+	*blob_id = id;
+	return true;
+}
+
+void drm_blob_cache_release(struct wlr_drm_backend *drm, uint32_t blob_id) {
+	if (blob_id == 0) {
+		return;
+	}
+
+	struct wlr_drm_blob_cache *cache = &drm->blob_cache;
+	struct wlr_drm_blob_cache_entry *entry;
+	wl_list_for_each(entry, &cache->entries, link) {
+		if (entry->id == blob_id) {
+			if (entry->refs > 0) {
+				entry->refs--;
+			}
+			evict_unused(cache, drm);
+			return;
+		}
+	}
+
+	destroy_blob(drm, blob_id);
+}
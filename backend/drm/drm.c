@@ -386,12 +386,10 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 	for (size_t i = 0; i < drm->num_crtcs; ++i) {
 		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
 
-		if (crtc->mode_id && crtc->own_mode_id) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->mode_id);
-		}
-		if (crtc->gamma_lut) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->gamma_lut);
+		if (crtc->own_mode_id) {
+			drm_blob_cache_release(drm, crtc->mode_id);
 		}
+		drm_blob_cache_release(drm, crtc->gamma_lut);
 	}
 
 	free(drm->crtcs);
@@ -747,7 +745,11 @@ static bool drm_connector_state_update_primary_fb(struct wlr_drm_connector *conn
 			return false;
 		}
 
-		local_buf = drm_surface_blit(&plane->mgpu_surf, source_buf,
+		const pixman_region32_t *damage = NULL;
+		if (state->base->committed & WLR_OUTPUT_STATE_DAMAGE) {
+			damage = &state->base->damage;
+		}
+		local_buf = drm_surface_blit(&plane->mgpu_surf, source_buf, damage,
 			wait_timeline, wait_point);
 		if (local_buf == NULL) {
 			return false;
@@ -1021,9 +1023,39 @@ static size_t drm_connector_get_gamma_size(struct wlr_output *output) {
 static void realloc_crtcs(struct wlr_drm_backend *drm,
 	struct wlr_drm_connector *want_conn);
 
+static struct wlr_drm_crtc *find_free_crtc(struct wlr_drm_connector *want_conn) {
+	struct wlr_drm_backend *drm = want_conn->backend;
+	for (size_t i = 0; i < drm->num_crtcs; i++) {
+		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
+		if (!(want_conn->possible_crtcs & (1 << i))) {
+			continue;
+		}
+
+		bool used = false;
+		struct wlr_drm_connector *conn;
+		wl_list_for_each(conn, &drm->connectors, link) {
+			if (conn->crtc == crtc) {
+				used = true;
+				break;
+			}
+		}
+		if (!used) {
+			return crtc;
+		}
+	}
+	return NULL;
+}
+
 static bool drm_connector_alloc_crtc(struct wlr_drm_connector *conn) {
 	if (conn->crtc == NULL) {
-		realloc_crtcs(conn->backend, conn);
+		// Only shuffle the other connectors' CRTCs if there is no free one
+		conn->crtc = find_free_crtc(conn);
+		if (conn->crtc != NULL) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Allocated free CRTC %"PRIu32,
+				conn->crtc->id);
+		} else {
+			realloc_crtcs(conn->backend, conn);
+		}
 	}
 	bool ok = conn->crtc != NULL;
 	if (!ok) {
@@ -1141,7 +1173,7 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 				return false;
 			}
 
-			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL, 0);
+			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL, NULL, 0);
 			if (local_buf == NULL) {
 				return false;
 			}
@@ -1736,11 +1768,117 @@ static bool connect_drm_connector(struct wlr_drm_connector *wlr_conn,
 
 static void disconnect_drm_connector(struct wlr_drm_connector *conn);
 
+static struct wlr_drm_connector *find_drm_connector(struct wlr_drm_backend *drm,
+		uint32_t id) {
+	struct wlr_drm_connector *conn;
+	wl_list_for_each(conn, &drm->connectors, link) {
+		if (conn->id == id) {
+			return conn;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Update a connector's status from the DRM connector. Returns true if the
+ * connector has just been connected, in which case the new output needs to be
+ * announced.
+ */
+static bool update_drm_connector(struct wlr_drm_connector *wlr_conn,
+		const drmModeConnector *drm_conn) {
+	struct wlr_drm_backend *drm = wlr_conn->backend;
+
+	// This can only happen *after* hotplug, since we haven't read the
+	// connector properties yet
+	if (wlr_conn->props.link_status != 0) {
+		uint64_t link_status;
+		if (!get_drm_prop(drm->fd, wlr_conn->id,
+				wlr_conn->props.link_status, &link_status)) {
+			wlr_drm_conn_log(wlr_conn, WLR_ERROR,
+				"Failed to get link status prop");
+			return false;
+		}
+
+		if (link_status == DRM_MODE_LINK_STATUS_BAD) {
+			// We need to reload our list of modes and force a modeset
+			wlr_drm_conn_log(wlr_conn, WLR_INFO, "Bad link detected");
+			disconnect_drm_connector(wlr_conn);
+		}
+	}
+
+	if (wlr_conn->status == DRM_MODE_DISCONNECTED &&
+			drm_conn->connection == DRM_MODE_CONNECTED) {
+		wlr_log(WLR_INFO, "'%s' connected", wlr_conn->name);
+		if (!connect_drm_connector(wlr_conn, drm_conn)) {
+			wlr_drm_conn_log(wlr_conn, WLR_ERROR, "Failed to connect DRM connector");
+			return false;
+		}
+		return true;
+	} else if (wlr_conn->status == DRM_MODE_CONNECTED &&
+			drm_conn->connection != DRM_MODE_CONNECTED) {
+		wlr_log(WLR_INFO, "'%s' disconnected", wlr_conn->name);
+		disconnect_drm_connector(wlr_conn);
+	}
+	return false;
+}
+
+/**
+ * Handle a hotplug event targeting a single known connector, without touching
+ * the other connectors. Returns false if a full scan is needed.
+ */
+static bool scan_drm_connector(struct wlr_drm_backend *drm,
+		const struct wlr_device_hotplug_event *event) {
+	struct wlr_drm_connector *wlr_conn = find_drm_connector(drm, event->connector_id);
+	if (wlr_conn == NULL) {
+		// New connector, e.g. on a DisplayPort MST hub
+		return false;
+	}
+	if (wlr_conn->lease) {
+		return true;
+	}
+
+	// Property change events don't require re-probing the connector, unless
+	// the link has gone bad
+	if (event->prop_id != 0) {
+		if (event->prop_id != wlr_conn->props.link_status) {
+			wlr_drm_conn_log(wlr_conn, WLR_DEBUG,
+				"Ignoring change of property %"PRIu32, event->prop_id);
+			return true;
+		}
+
+		uint64_t link_status;
+		if (get_drm_prop(drm->fd, wlr_conn->id, wlr_conn->props.link_status,
+				&link_status) && link_status != DRM_MODE_LINK_STATUS_BAD) {
+			return true;
+		}
+	}
+
+	drmModeConnector *drm_conn = drmModeGetConnector(drm->fd, wlr_conn->id);
+	if (!drm_conn) {
+		// The connector may have disappeared
+		wlr_log_errno(WLR_DEBUG, "Failed to get DRM connector");
+		return false;
+	}
+
+	bool connected = update_drm_connector(wlr_conn, drm_conn);
+	drmModeFreeConnector(drm_conn);
+
+	if (connected) {
+		wlr_drm_conn_log(wlr_conn, WLR_INFO, "Requesting modeset");
+		wl_signal_emit_mutable(&drm->backend.events.new_output,
+			&wlr_conn->output);
+	}
+	return true;
+}
+
 void scan_drm_connectors(struct wlr_drm_backend *drm,
 		struct wlr_device_hotplug_event *event) {
 	if (event != NULL && event->connector_id != 0) {
 		wlr_log(WLR_INFO, "Scanning DRM connector %"PRIu32" on %s",
 			event->connector_id, drm->name);
+		if (scan_drm_connector(drm, event)) {
+			return;
+		}
 	} else {
 		wlr_log(WLR_INFO, "Scanning DRM connectors on %s", drm->name);
 	}
@@ -1795,6 +1933,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 		if (!wlr_conn) {
 			wlr_conn = create_drm_connector(drm, drm_conn);
 			if (wlr_conn == NULL) {
+				drmModeFreeConnector(drm_conn);
 				continue;
 			}
 			wlr_log(WLR_INFO, "Found connector '%s'", wlr_conn->name);
@@ -1802,36 +1941,8 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 			seen[index] = true;
 		}
 
-		// This can only happen *after* hotplug, since we haven't read the
-		// connector properties yet
-		if (wlr_conn->props.link_status != 0) {
-			uint64_t link_status;
-			if (!get_drm_prop(drm->fd, wlr_conn->id,
-					wlr_conn->props.link_status, &link_status)) {
-				wlr_drm_conn_log(wlr_conn, WLR_ERROR,
-					"Failed to get link status prop");
-				continue;
-			}
-
-			if (link_status == DRM_MODE_LINK_STATUS_BAD) {
-				// We need to reload our list of modes and force a modeset
-				wlr_drm_conn_log(wlr_conn, WLR_INFO, "Bad link detected");
-				disconnect_drm_connector(wlr_conn);
-			}
-		}
-
-		if (wlr_conn->status == DRM_MODE_DISCONNECTED &&
-				drm_conn->connection == DRM_MODE_CONNECTED) {
-			wlr_log(WLR_INFO, "'%s' connected", wlr_conn->name);
-			if (!connect_drm_connector(wlr_conn, drm_conn)) {
-				wlr_drm_conn_log(wlr_conn, WLR_ERROR, "Failed to connect DRM connector");
-				continue;
-			}
+		if (update_drm_connector(wlr_conn, drm_conn)) {
 			new_outputs[new_outputs_len++] = wlr_conn;
-		} else if (wlr_conn->status == DRM_MODE_CONNECTED &&
-				drm_conn->connection != DRM_MODE_CONNECTED) {
-			wlr_log(WLR_INFO, "'%s' disconnected", wlr_conn->name);
-			disconnect_drm_connector(wlr_conn);
 		}
 
 		drmModeFreeConnector(drm_conn);
@@ -1906,6 +2017,11 @@ bool commit_drm_device(struct wlr_drm_backend *drm,
 
 	bool ok = false;
 	bool modeset = false;
+	// Don't wait for the vblank when all connectors flip to a new buffer, so
+	// that commits spanning multiple devices aren't serialized by the
+	// multi-backend. See drm_connector_commit_state() for the EBUSY caveat,
+	// and don't queue a page-flip on top of a pending one.
+	bool nonblock = true;
 	size_t conn_states_len = 0;
 	for (size_t i = 0; i < output_states_len; i++) {
 		const struct wlr_backend_output_state *output_state = &output_states[i];
@@ -1938,6 +2054,8 @@ bool commit_drm_device(struct wlr_drm_backend *drm,
 		}
 
 		modeset |= output_state->base.allow_reconfiguration;
+		nonblock = nonblock && (output_state->base.committed & WLR_OUTPUT_STATE_BUFFER) &&
+			conn->pending_page_flip == NULL;
 	}
 
 	if (test_only && drm->mgpu_renderer.wlr_rend) {
@@ -1953,6 +2071,7 @@ bool commit_drm_device(struct wlr_drm_backend *drm,
 	}
 	struct wlr_drm_device_state dev_state = {
 		.modeset = modeset,
+		.nonblock = nonblock && !modeset,
 		.connectors = conn_states,
 		.connectors_len = conn_states_len,
 	};
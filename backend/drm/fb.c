@@ -215,6 +215,9 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	wl_list_remove(&fb->link);
 	wlr_addon_finish(&fb->addon);
 
+	// The kernel may hand out this FB ID again
+	drm_test_cache_clear(&drm->test_cache);
+
 	int ret = drmModeCloseFB(drm->fd, fb->id);
 	if (ret == -EINVAL) {
 		ret = drmModeRmFB(drm->fd, fb->id);
@@ -495,9 +495,7 @@ out:
 
 	uint32_t *fb_damage_clips_ptr;
 	wl_array_for_each(fb_damage_clips_ptr, &fb_damage_clips_arr) {
-		if (drmModeDestroyPropertyBlob(drm->fd, *fb_damage_clips_ptr) != 0) {
-			wlr_log_errno(WLR_ERROR, "Failed to destroy FB_DAMAGE_CLIPS property blob");
-		}
+		drm_blob_cache_release(drm, *fb_damage_clips_ptr);
 	}
 	wl_array_release(&fb_damage_clips_arr);
 
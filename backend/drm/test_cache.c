@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include "backend/drm/drm.h"
+#include "backend/drm/fb.h"
+#include "backend/drm/test_cache.h"
+#include "util/env.h"
+#include "util/hash.h"
+
+#define TEST_CACHE_MAX_ENTRIES 32
+
+struct wlr_drm_test_cache_entry {
+	struct wl_list link; // wlr_drm_test_cache.entries
+	uint64_t hash;
+	void *key;
+	size_t key_len;
+	bool ok;
+};
+
+static uint64_t hash_key(const struct wl_array *key) {
+	return hash_fnv1a(key->data, key->size);
+}
+
+static void entry_destroy(struct wlr_drm_test_cache *cache,
+		struct wlr_drm_test_cache_entry *entry) {
+	wl_list_remove(&entry->link);
+	cache->entries_len--;
+	free(entry->key);
+	free(entry);
+}
+
+void drm_test_cache_init(struct wlr_drm_test_cache *cache) {
+	*cache = (struct wlr_drm_test_cache){
+		.enabled = !env_parse_bool("WLR_DRM_NO_TEST_CACHE"),
+	};
+	wl_list_init(&cache->entries);
+}
+
+void drm_test_cache_finish(struct wlr_drm_test_cache *cache) {
+	drm_test_cache_clear(cache);
+}
+
+void drm_test_cache_clear(struct wlr_drm_test_cache *cache) {
+	struct wlr_drm_test_cache_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &cache->entries, link) {
+		entry_destroy(cache, entry);
+	}
+}
+
+static bool key_add(struct wl_array *key, const void *data, size_t size) {
+	void *dst = wl_array_add(key, size);
+	if (dst == NULL) {
+		return false;
+	}
+	memcpy(dst, data, size);
+	return true;
+}
+
+static bool key_add_u64(struct wl_array *key, uint64_t value) {
+	return key_add(key, &value, sizeof(value));
+}
+
+static bool key_add_fb(struct wl_array *key, struct wlr_drm_fb *fb) {
+	if (fb == NULL) {
+		return key_add_u64(key, 0);
+	}
+
+	struct wlr_buffer *buffer = fb->wlr_buf;
+	struct wlr_dmabuf_attributes attribs;
+	if (!wlr_buffer_get_dmabuf(buffer, &attribs)) {
+		return false;
+	}
+
+	// Buffers with the same attributes can still differ in whether they can
+	// be scanned out (e.g. VRAM vs. GTT), so identify the buffer itself. FB
+	// IDs are only recycled after drm_fb_destroy(), which clears the cache.
+	bool ok = key_add_u64(key, 1) &&
+		key_add_u64(key, fb->id) &&
+		key_add_u64(key, (uint64_t)buffer->width << 32 | (uint32_t)buffer->height) &&
+		key_add_u64(key, attribs.format) &&
+		key_add_u64(key, attribs.modifier) &&
+		key_add_u64(key, attribs.n_planes);
+	for (int i = 0; ok && i < attribs.n_planes; i++) {
+		ok = key_add_u64(key, (uint64_t)attribs.offset[i] << 32 | attribs.stride[i]);
+	}
+	return ok;
+}
+
+static bool key_add_connector(struct wl_array *key,
+		const struct wlr_drm_connector_state *state) {
+	struct wlr_drm_connector *conn = state->connector;
+	struct wlr_output *output = &conn->output;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	const struct wlr_output_state *base = state->base;
+
+	bool vrr_enabled =
+		output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+	if (base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		vrr_enabled = base->adaptive_sync_enabled;
+	}
+
+	size_t gamma_lut_size = 0;
+	if (base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
+		gamma_lut_size = base->gamma_lut != NULL ? base->gamma_lut_size : SIZE_MAX;
+	}
+
+	const struct wlr_fbox *src = &state->primary_viewport.src_box;
+	const struct wlr_box *dst = &state->primary_viewport.dst_box;
+	bool ok = key_add_u64(key, conn->id) &&
+		key_add_u64(key, crtc->id) &&
+		key_add_u64(key, state->active) &&
+		key_add(key, &state->mode, sizeof(state->mode)) &&
+		key_add_u64(key, gamma_lut_size) &&
+		key_add_u64(key, vrr_enabled) &&
+		key_add_u64(key, state->wait_timeline != NULL) &&
+		key_add_u64(key, (base->committed & WLR_OUTPUT_STATE_SIGNAL_TIMELINE) != 0) &&
+		key_add_fb(key, state->primary_fb) &&
+		key_add(key, src, sizeof(*src)) &&
+		key_add(key, dst, sizeof(*dst));
+	if (!ok) {
+		return false;
+	}
+
+	if (crtc->cursor == NULL || !drm_connector_is_cursor_visible(conn)) {
+		return key_add_u64(key, 0);
+	}
+	return key_add_u64(key, 1) &&
+		key_add_fb(key, state->cursor_fb) &&
+		key_add_u64(key, (uint64_t)(uint32_t)conn->cursor_x << 32 | (uint32_t)conn->cursor_y) &&
+		key_add_u64(key, (uint64_t)(uint32_t)conn->cursor_hotspot_x << 32 |
+			(uint32_t)conn->cursor_hotspot_y);
+}
+
+static struct wlr_drm_fb *plane_committed_fb(struct wlr_drm_plane *plane) {
+	return plane->queued_fb != NULL ? plane->queued_fb : plane->current_fb;
+}
+
+static bool key_add_plane(struct wl_array *key, struct wlr_drm_plane *plane) {
+	if (plane == NULL) {
+		return key_add_u64(key, 0);
+	}
+	struct wlr_drm_fb *fb = plane_committed_fb(plane);
+	return key_add_fb(key, fb) &&
+		(fb == NULL || key_add(key, &plane->viewport, sizeof(plane->viewport)));
+}
+
+static bool state_has_crtc(const struct wlr_drm_device_state *state,
+		const struct wlr_drm_crtc *crtc) {
+	for (size_t i = 0; i < state->connectors_len; i++) {
+		if (state->connectors[i].connector->crtc == crtc) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool drm_test_cache_build_key(struct wl_array *key, struct wlr_drm_backend *drm,
+		const struct wlr_drm_device_state *state, uint32_t flags) {
+	if (!key_add_u64(key, flags) ||
+			!key_add_u64(key, state->modeset) ||
+			!key_add_u64(key, state->connectors_len)) {
+		return false;
+	}
+	for (size_t i = 0; i < state->connectors_len; i++) {
+		const struct wlr_drm_connector_state *conn_state = &state->connectors[i];
+		if (conn_state->connector->crtc == NULL ||
+				!key_add_connector(key, conn_state)) {
+			return false;
+		}
+	}
+
+	// Planes of the other CRTCs share bandwidth and watermarks with the
+	// tested ones, so their committed configuration affects the result too
+	for (size_t i = 0; i < drm->num_crtcs; i++) {
+		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
+		if (state_has_crtc(state, crtc)) {
+			continue;
+		}
+		if (!key_add_plane(key, crtc->primary) ||
+				!key_add_plane(key, crtc->cursor)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct wlr_drm_test_cache_entry *cache_find(
+		struct wlr_drm_test_cache *cache, const struct wl_array *key,
+		uint64_t hash) {
+	struct wlr_drm_test_cache_entry *entry;
+	wl_list_for_each(entry, &cache->entries, link) {
+		if (entry->hash == hash && entry->key_len == key->size &&
+				memcmp(entry->key, key->data, key->size) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool drm_test_cache_lookup(struct wlr_drm_test_cache *cache,
+		const struct wl_array *key, bool *ok) {
+	struct wlr_drm_test_cache_entry *entry =
+		cache_find(cache, key, hash_key(key));
+	if (entry == NULL) {
+		cache->misses++;
+		return false;
+	}
+
+	// Keep the most recently used entries at the front
+	wl_list_remove(&entry->link);
+	wl_list_insert(&cache->entries, &entry->link);
+
+	cache->hits++;
+	*ok = entry->ok;
+	return true;
+}
+
+void drm_test_cache_insert(struct wlr_drm_test_cache *cache,
+		const struct wl_array *key, bool ok) {
+	uint64_t hash = hash_key(key);
+	struct wlr_drm_test_cache_entry *entry = cache_find(cache, key, hash);
+	if (entry != NULL) {
+		entry->ok = ok;
+		return;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		return;
+	}
+	entry->key = malloc(key->size);
+	if (entry->key == NULL) {
+		free(entry);
+		return;
+	}
+	memcpy(entry->key, key->data, key->size);
+	entry->key_len = key->size;
+	entry->hash = hash;
+	entry->ok = ok;
+
+	if (cache->entries_len == TEST_CACHE_MAX_ENTRIES) {
+		struct wlr_drm_test_cache_entry *last =
+			wl_container_of(cache->entries.prev, last, link);
+		entry_destroy(cache, last);
+	}
+	wl_list_insert(&cache->entries, &entry->link);
+	cache->entries_len++;
+}
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/util/log.h>
 #include "backend/headless.h"
+#include "util/env.h"
 
 struct wlr_headless_backend *headless_backend_from_backend(
 		struct wlr_backend *wlr_backend) {
@@ -50,6 +53,23 @@ static const struct wlr_backend_impl backend_impl = {
 	.destroy = backend_destroy,
 };
 
+static double parse_missed_flip_rate(void) {
+	const char *str = getenv("WLR_HEADLESS_MISSED_FLIP_RATE");
+	if (str == NULL) {
+		return 0;
+	}
+
+	char *end;
+	double rate = strtod(str, &end);
+	if (*str == '\0' || *end || !(rate >= 0 && rate <= 1)) {
+		wlr_log(WLR_ERROR, "WLR_HEADLESS_MISSED_FLIP_RATE specified with "
+			"invalid number, ignoring");
+		return 0;
+	}
+
+	return rate;
+}
+
 static void handle_event_loop_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_headless_backend *backend =
 		wl_container_of(listener, backend, event_loop_destroy);
@@ -77,6 +97,19 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_event_loop *loop) {
 	wl_event_loop_add_destroy_listener(loop, &backend->event_loop_destroy);
 
 	backend->backend.features.timeline = true;
+	long max_output_layers =
+		env_parse_long("WLR_HEADLESS_OUTPUT_LAYERS", 0, LONG_MAX, -1);
+	backend->max_output_layers = max_output_layers >= 0 ? (size_t)max_output_layers : SIZE_MAX;
+
+	// Bounded so that the conversion to mHz and nanoseconds can't overflow
+	backend->default_timing = (struct wlr_headless_output_timing){
+		.vrr_min_refresh = (int32_t)env_parse_long(
+			"WLR_HEADLESS_VRR_MIN_REFRESH", 0, 1000, 0) * 1000,
+		.jitter = (int64_t)env_parse_long(
+			"WLR_HEADLESS_PRESENT_JITTER", 0, 1000000, 0) * 1000,
+		.missed_flip_rate = parse_missed_flip_rate(),
+	};
+	backend->seed = env_parse_long("WLR_HEADLESS_SEED", 0, LONG_MAX, 1);
 
 	return &backend->backend;
 }
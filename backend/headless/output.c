@@ -6,12 +6,15 @@
 #include <wlr/util/log.h>
 #include "backend/headless.h"
 #include "types/wlr_output.h"
+#include "util/rand.h"
+#include "util/time.h"
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
 	WLR_OUTPUT_STATE_BUFFER |
 	WLR_OUTPUT_STATE_ENABLED |
-	WLR_OUTPUT_STATE_MODE;
+	WLR_OUTPUT_STATE_MODE |
+	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED;
 
 static size_t last_output_num = 0;
 
@@ -28,11 +31,97 @@ static void output_update_refresh(struct wlr_headless_output *output,
 		refresh = HEADLESS_DEFAULT_REFRESH;
 	}
 
-	output->frame_delay = 1000000 / refresh;
+	output->refresh_ns = 1000000000000ll / refresh;
+	// The display clock restarts with the new mode
+	output->vblank_ns = get_current_time_nsec();
+}
+
+static double output_rand(struct wlr_headless_output *output) {
+	uint64_t v = rand_xorshift64(&output->rng);
+	return (double)(v >> 11) / (double)(UINT64_C(1) << 53);
+}
+
+static void output_cancel_flip(struct wlr_headless_output *output) {
+	if (!output->flip_pending) {
+		return;
+	}
+	output->flip_pending = false;
+
+	struct wlr_output_event_present present_event = {
+		.commit_seq = output->flip_present.commit_seq,
+		.presented = false,
+	};
+	output_defer_present(&output->wlr_output, present_event);
+}
+
+/**
+ * Queues a page-flip for the next vblank of the simulated display, the frame
+ * and present events are sent when it's reached.
+ */
+static void output_schedule_flip(struct wlr_headless_output *output,
+		uint32_t commit_seq) {
+	// A flip which didn't reach its vblank yet is replaced
+	output_cancel_flip(output);
+
+	int64_t now = get_current_time_nsec();
+	int64_t refresh = output->refresh_ns;
+	int64_t elapsed = now > output->vblank_ns ? now - output->vblank_ns : 0;
+
+	int64_t max_period = 0;
+	if (output->wlr_output.adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED &&
+			output->timing.vrr_min_refresh > 0) {
+		max_period = 1000000000000ll / output->timing.vrr_min_refresh;
+	}
+
+	int64_t flip;
+	unsigned seq;
+	if (max_period > refresh) {
+		// The display refreshes on its own once the longest period elapsed,
+		// and can't start a new refresh before the shortest one did
+		int64_t cycles = elapsed / max_period;
+		int64_t last = output->vblank_ns + cycles * max_period;
+		flip = now > last + refresh ? now : last + refresh;
+		seq = output->vblank_seq + cycles + 1;
+	} else {
+		int64_t cycles = elapsed / refresh + 1;
+		flip = output->vblank_ns + cycles * refresh;
+		seq = output->vblank_seq + cycles;
+	}
+
+	if (output->timing.missed_flip_rate > 0 &&
+			output_rand(output) < output->timing.missed_flip_rate) {
+		flip += refresh;
+		seq++;
+	}
+
+	// The hardware clock isn't exact, but the display clock itself is
+	int64_t when = flip;
+	if (output->timing.jitter > 0) {
+		when += (int64_t)((output_rand(output) * 2 - 1) * output->timing.jitter);
+	}
+
+	output->flip_pending = true;
+	output->flip_ns = flip;
+	output->flip_present = (struct wlr_output_event_present){
+		.commit_seq = commit_seq,
+		.presented = true,
+		.seq = seq,
+		.refresh = (int)refresh,
+		.flags = WLR_OUTPUT_PRESENT_VSYNC | WLR_OUTPUT_PRESENT_HW_CLOCK |
+			WLR_OUTPUT_PRESENT_HW_COMPLETION,
+	};
+	timespec_from_nsec(&output->flip_present.when, when);
+
+	// Event loop timers have a millisecond granularity, round up
+	int delay_ms = (flip - now + 999999) / 1000000;
+	wl_event_source_timer_update(output->frame_timer, delay_ms > 0 ? delay_ms : 1);
 }
 
 static bool output_test(struct wlr_output *wlr_output,
 		const struct wlr_output_state *state) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+
 	uint32_t unsupported = state->committed & ~SUPPORTED_OUTPUT_STATE;
 	if (unsupported != 0) {
 		wlr_log(WLR_DEBUG, "Unsupported output state fields: 0x%"PRIx32,
@@ -44,9 +133,22 @@ static bool output_test(struct wlr_output *wlr_output,
 		assert(state->mode_type == WLR_OUTPUT_STATE_MODE_CUSTOM);
 	}
 
+	if ((state->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) &&
+			state->adaptive_sync_enabled && output->timing.vrr_min_refresh <= 0) {
+		wlr_log(WLR_DEBUG, "Adaptive sync is not supported");
+		return false;
+	}
+
 	if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
-		for (size_t i = 0; i < state->layers_len; i++) {
-			state->layers[i].accepted = true;
+		// Accept the topmost layers up to the limit, like a display engine
+		// with a fixed amount of overlay planes would
+		size_t available = output->backend->max_output_layers;
+		for (size_t i = state->layers_len; i-- > 0;) {
+			struct wlr_output_layer_state *layer_state = &state->layers[i];
+			layer_state->accepted = layer_state->buffer == NULL || available > 0;
+			if (layer_state->buffer != NULL && available > 0) {
+				available--;
+			}
 		}
 	}
 
@@ -64,16 +166,21 @@ static bool output_commit(struct wlr_output *wlr_output,
 
 	if (state->committed & WLR_OUTPUT_STATE_MODE) {
 		output_update_refresh(output, state->custom_mode.refresh);
+	} else if ((state->committed & WLR_OUTPUT_STATE_ENABLED) &&
+			state->enabled && !wlr_output->enabled) {
+		output_update_refresh(output, wlr_output->refresh);
 	}
 
-	if (output_pending_enabled(wlr_output, state)) {
-		struct wlr_output_event_present present_event = {
-			.commit_seq = wlr_output->commit_seq + 1,
-			.presented = true,
-		};
-		output_defer_present(wlr_output, present_event);
+	if (state->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		wlr_output->adaptive_sync_status = state->adaptive_sync_enabled ?
+			WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED : WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	}
 
-		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+	if (output_pending_enabled(wlr_output, state)) {
+		output_schedule_flip(output, wlr_output->commit_seq + 1);
+	} else {
+		output_cancel_flip(output);
+		wl_event_source_timer_update(output->frame_timer, 0);
 	}
 
 	return true;
@@ -112,10 +219,29 @@ bool wlr_output_is_headless(struct wlr_output *wlr_output) {
 
 static int signal_frame(void *data) {
 	struct wlr_headless_output *output = data;
+
+	if (output->flip_pending) {
+		output->flip_pending = false;
+		output->vblank_ns = output->flip_ns;
+		output->vblank_seq = output->flip_present.seq;
+		wlr_output_send_present(&output->wlr_output, &output->flip_present);
+	}
+
 	wlr_output_send_frame(&output->wlr_output);
 	return 0;
 }
 
+void wlr_headless_output_set_timing(struct wlr_output *wlr_output,
+		const struct wlr_headless_output_timing *timing) {
+	struct wlr_headless_output *output = headless_output_from_output(wlr_output);
+	output->timing = *timing;
+
+	wlr_output->adaptive_sync_supported = timing->vrr_min_refresh > 0;
+	if (!wlr_output->adaptive_sync_supported) {
+		wlr_output->adaptive_sync_status = WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	}
+}
+
 struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 		unsigned int width, unsigned int height) {
 	struct wlr_headless_backend *backend =
@@ -140,6 +266,9 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 
 	size_t output_num = ++last_output_num;
 
+	output->rng = rand_xorshift64_seed(backend->seed + output_num);
+	wlr_headless_output_set_timing(wlr_output, &backend->default_timing);
+
 	char name[64];
 	snprintf(name, sizeof(name), "HEADLESS-%zu", output_num);
 	wlr_output_set_name(wlr_output, name);
@@ -94,6 +94,16 @@ static int compare_output_state_backend(const void *data_a, const void *data_b)
 	}
 }
 
+static size_t group_len(const struct wlr_backend_output_state *states,
+		size_t states_len, size_t start) {
+	struct wlr_backend *sub = states[start].output->backend;
+	size_t len = 1;
+	while (start + len < states_len && states[start + len].output->backend == sub) {
+		len++;
+	}
+	return len;
+}
+
 static bool commit(struct wlr_backend *backend,
 		const struct wlr_backend_output_state *states, size_t states_len,
 		bool test_only) {
@@ -105,24 +115,35 @@ static bool commit(struct wlr_backend *backend,
 	memcpy(by_backend, states, states_len * sizeof(by_backend[0]));
 	qsort(by_backend, states_len, sizeof(by_backend[0]), compare_output_state_backend);
 
+	// Test all backends before committing any of them, so that a rejected
+	// configuration doesn't leave some of the backends committed. Sub-backends
+	// don't wait for each other's vblanks: the DRM backend queues
+	// non-modeset page-flips without blocking.
+	//
+	// This is not atomic across backends: a commit can still fail after a
+	// successful test (e.g. on a secondary DRM device, where tests succeed
+	// without blitting or reaching KMS). If the commit of a group fails, the
+	// groups before it stay committed and are not rolled back.
 	bool ok = true;
-	for (size_t i = 0; i < states_len;) {
-		struct wlr_backend *sub = by_backend[i].output->backend;
-
-		size_t len = 1;
-		while (i + len < states_len &&
-				by_backend[i + len].output->backend == sub) {
-			len++;
+	bool multiple = states_len > 0 &&
+		group_len(by_backend, states_len, 0) < states_len;
+	if (!test_only && multiple) {
+		for (size_t i = 0; ok && i < states_len;) {
+			size_t len = group_len(by_backend, states_len, i);
+			ok = wlr_backend_test(by_backend[i].output->backend, &by_backend[i], len);
+			i += len;
 		}
+	}
+
+	for (size_t i = 0; ok && i < states_len;) {
+		struct wlr_backend *sub = by_backend[i].output->backend;
+		size_t len = group_len(by_backend, states_len, i);
 
 		if (test_only) {
 			ok = wlr_backend_test(sub, &by_backend[i], len);
 		} else {
 			ok = wlr_backend_commit(sub, &by_backend[i], len);
 		}
-		if (!ok) {
-			break;
-		}
 		i += len;
 	}
 
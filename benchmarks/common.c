@@ -0,0 +1,54 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "common.h"
+
+int64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void samples_add(struct samples *samples, int64_t value) {
+	if (samples->len == samples->cap) {
+		size_t cap = samples->cap > 0 ? samples->cap * 2 : 256;
+		int64_t *values = realloc(samples->values, cap * sizeof(*values));
+		if (values == NULL) {
+			return;
+		}
+		samples->values = values;
+		samples->cap = cap;
+	}
+	samples->values[samples->len++] = value;
+}
+
+void samples_finish(struct samples *samples) {
+	free(samples->values);
+	*samples = (struct samples){0};
+}
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+	return (va > vb) - (va < vb);
+}
+
+void samples_print(struct samples *samples, const char *name) {
+	int64_t sum = 0;
+	for (size_t i = 0; i < samples->len; i++) {
+		sum += samples->values[i];
+	}
+
+	int64_t median = 0, p99 = 0, max = 0;
+	if (samples->len > 0) {
+		qsort(samples->values, samples->len, sizeof(samples->values[0]),
+			compare_int64);
+		median = samples->values[samples->len / 2];
+		p99 = samples->values[(samples->len * 99) / 100];
+		max = samples->values[samples->len - 1];
+	}
+
+	printf("\"%s\":{\"mean\":%"PRId64",\"median\":%"PRId64","
+		"\"p99\":%"PRId64",\"max\":%"PRId64"}", name,
+		samples->len > 0 ? sum / (int64_t)samples->len : 0, median, p99, max);
+}
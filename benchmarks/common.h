@@ -0,0 +1,22 @@
+#ifndef BENCHMARKS_COMMON_H
+#define BENCHMARKS_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct samples {
+	int64_t *values;
+	size_t len, cap;
+};
+
+int64_t get_time_ns(void);
+
+void samples_add(struct samples *samples, int64_t value);
+void samples_finish(struct samples *samples);
+/**
+ * Print the mean, median, 99th percentile and maximum of the samples as a
+ * JSON object member. The samples are sorted in place.
+ */
+void samples_print(struct samples *samples, const char *name);
+
+#endif
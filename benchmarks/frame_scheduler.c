@@ -0,0 +1,283 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_frame_scheduler.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+#include "common.h"
+
+/*
+ * Frame pacing benchmark driven by the headless backend's simulated display
+ * clock. Each frame burns a fixed amount of CPU time to emulate rendering,
+ * then commits the scene. Results are printed as a single JSON object on
+ * stdout:
+ *
+ *  - latency_ns: time between the frame event and the presentation of the
+ *    frame, i.e. the input-to-photon latency of an update received right
+ *    before the frame event
+ *  - missed_vblanks: number of vblanks without a new frame
+ *
+ * The display clock can be made less regular with the WLR_HEADLESS_*
+ * environment variables.
+ */
+
+struct bench_options {
+	bool scheduler;
+	int frames;
+	int64_t render_ns;
+	int width, height;
+};
+
+struct bench {
+	struct bench_options options;
+
+	struct wl_event_loop *event_loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_output *output;
+	struct wlr_frame_scheduler *scheduler;
+
+	struct wlr_scene *scene;
+	struct wlr_scene_output *scene_output;
+	struct wlr_scene_rect *rect;
+
+	int frame;
+	bool failed;
+	int64_t frame_start;
+	uint32_t commit_seq;
+	unsigned last_seq;
+	int missed_vblanks;
+	struct samples latency;
+
+	struct wl_listener frame_listener;
+	struct wl_listener present;
+};
+
+static void bench_render_frame(struct bench *bench) {
+	bench->frame_start = get_time_ns();
+
+	// Emulate the rendering work
+	while (get_time_ns() - bench->frame_start < bench->options.render_ns) {
+		// Spin
+	}
+
+	// Damage the whole output on every frame
+	float color[4] = { bench->frame % 2, 0, 0, 1 };
+	wlr_scene_rect_set_color(bench->rect, color);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	bool ok = wlr_scene_output_build_state(bench->scene_output, &state, NULL) &&
+		wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		fprintf(stderr, "Failed to commit frame %d\n", bench->frame);
+		bench->failed = true;
+		return;
+	}
+
+	bench->commit_seq = bench->output->commit_seq;
+	bench->frame++;
+
+	if (bench->scheduler != NULL) {
+		wlr_frame_scheduler_inform_render(bench->scheduler,
+			get_time_ns() - bench->frame_start, NULL);
+	}
+}
+
+static void handle_frame(struct wl_listener *listener, void *data) {
+	struct bench *bench = wl_container_of(listener, bench, frame_listener);
+	if (bench->frame < bench->options.frames) {
+		bench_render_frame(bench);
+	}
+}
+
+static void handle_present(struct wl_listener *listener, void *data) {
+	struct bench *bench = wl_container_of(listener, bench, present);
+	struct wlr_output_event_present *event = data;
+	if (!event->presented || event->commit_seq != bench->commit_seq) {
+		return;
+	}
+
+	int64_t when = (int64_t)event->when.tv_sec * 1000000000 + event->when.tv_nsec;
+	samples_add(&bench->latency, when - bench->frame_start);
+
+	if (bench->last_seq != 0 && event->seq > bench->last_seq + 1) {
+		bench->missed_vblanks += event->seq - bench->last_seq - 1;
+	}
+	bench->last_seq = event->seq;
+}
+
+static bool bench_init(struct bench *bench) {
+	bench->event_loop = wl_event_loop_create();
+	if (bench->event_loop == NULL) {
+		return false;
+	}
+
+	bench->backend = wlr_headless_backend_create(bench->event_loop);
+	bench->renderer = wlr_pixman_renderer_create();
+	if (bench->backend == NULL || bench->renderer == NULL) {
+		return false;
+	}
+
+	bench->allocator = wlr_allocator_autocreate(bench->backend, bench->renderer);
+	if (bench->allocator == NULL || !wlr_backend_start(bench->backend)) {
+		return false;
+	}
+
+	bench->output = wlr_headless_add_output(bench->backend,
+		bench->options.width, bench->options.height);
+	if (bench->output == NULL ||
+			!wlr_output_init_render(bench->output, bench->allocator, bench->renderer)) {
+		return false;
+	}
+
+	bench->scene = wlr_scene_create();
+	if (bench->scene == NULL) {
+		return false;
+	}
+	float color[4] = { 0, 0, 0, 1 };
+	bench->rect = wlr_scene_rect_create(&bench->scene->tree,
+		bench->options.width, bench->options.height, color);
+	bench->scene_output = wlr_scene_output_create(bench->scene, bench->output);
+	if (bench->rect == NULL || bench->scene_output == NULL) {
+		return false;
+	}
+
+	struct wl_signal *frame_signal = &bench->output->events.frame;
+	if (bench->options.scheduler) {
+		bench->scheduler = wlr_frame_scheduler_create(bench->output);
+		if (bench->scheduler == NULL) {
+			return false;
+		}
+		frame_signal = &bench->scheduler->events.frame;
+	}
+
+	bench->frame_listener.notify = handle_frame;
+	wl_signal_add(frame_signal, &bench->frame_listener);
+	bench->present.notify = handle_present;
+	wl_signal_add(&bench->output->events.present, &bench->present);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	bool ok = wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	return ok;
+}
+
+static void bench_finish(struct bench *bench) {
+	if (bench->frame_listener.link.next != NULL) {
+		wl_list_remove(&bench->frame_listener.link);
+		wl_list_remove(&bench->present.link);
+	}
+	if (bench->scene != NULL) {
+		wlr_scene_node_destroy(&bench->scene->tree.node);
+	}
+	if (bench->backend != NULL) {
+		wlr_backend_destroy(bench->backend);
+	}
+	if (bench->allocator != NULL) {
+		wlr_allocator_destroy(bench->allocator);
+	}
+	if (bench->renderer != NULL) {
+		wlr_renderer_destroy(bench->renderer);
+	}
+	if (bench->event_loop != NULL) {
+		wl_event_loop_destroy(bench->event_loop);
+	}
+	samples_finish(&bench->latency);
+}
+
+static const char usage[] =
+	"usage: bench-frame-scheduler [options...]\n"
+	"  -s          delay frames with a wlr_frame_scheduler\n"
+	"  -f <count>  number of frames (default: 300)\n"
+	"  -r <usec>   CPU time spent rendering each frame (default: 2000)\n"
+	"  -W <width>  output width (default: 1920)\n"
+	"  -H <height> output height (default: 1080)\n"
+	"  -h          show this help message\n";
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench bench = {
+		.options = {
+			.frames = 300,
+			.render_ns = 2000000,
+			.width = 1920,
+			.height = 1080,
+		},
+	};
+	struct bench_options *options = &bench.options;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "sf:r:W:H:h")) != -1) {
+		switch (opt) {
+		case 's':
+			options->scheduler = true;
+			break;
+		case 'f':
+			options->frames = atoi(optarg);
+			break;
+		case 'r':
+			options->render_ns = (int64_t)atoi(optarg) * 1000;
+			break;
+		case 'W':
+			options->width = atoi(optarg);
+			break;
+		case 'H':
+			options->height = atoi(optarg);
+			break;
+		case 'h':
+			printf("%s", usage);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, "%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options->frames <= 0 || options->render_ns < 0 ||
+			options->width <= 0 || options->height <= 0) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_FAILURE;
+	if (!bench_init(&bench)) {
+		fprintf(stderr, "Failed to set up the benchmark\n");
+		goto out;
+	}
+
+	// The last frame is done once it's presented
+	while (!bench.failed && (int)bench.latency.len < options->frames) {
+		if (wl_event_loop_dispatch(bench.event_loop, -1) < 0) {
+			fprintf(stderr, "Failed to dispatch events\n");
+			goto out;
+		}
+	}
+	if (bench.failed) {
+		goto out;
+	}
+
+	printf("{\"scheduler\":%s,\"frames\":%d,\"render_ns\":%"PRId64",",
+		options->scheduler ? "true" : "false", options->frames, options->render_ns);
+	samples_print(&bench.latency, "latency_ns");
+	printf(",\"missed_vblanks\":%d}\n", bench.missed_vblanks);
+
+	ret = EXIT_SUCCESS;
+
+out:
+	bench_finish(&bench);
+	return ret;
+}
@@ -0,0 +1,277 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+#include <wayland-server-protocol.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/pass.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/log.h>
+#include "common.h"
+#include "util/rand.h"
+
+/*
+ * Pixman renderer benchmark: draws a full-screen texture with a given output
+ * transform, once through pixman's generic transform path and once through
+ * the renderer's dedicated blit kernels. Results are printed as a single
+ * JSON object on stdout:
+ *
+ *  - generic_ns: duration of a render pass using the generic path
+ *  - kernels_ns: duration of a render pass using the blit kernels
+ *  - identical: whether both paths produced the same pixels
+ */
+
+struct bench_options {
+	int width, height;
+	int frames;
+	enum wl_output_transform transform;
+	bool blend;
+};
+
+struct bench_buffer {
+	struct wlr_buffer base;
+	void *data;
+	size_t stride;
+};
+
+static const char *transform_names[] = {
+	[WL_OUTPUT_TRANSFORM_NORMAL] = "normal",
+	[WL_OUTPUT_TRANSFORM_90] = "90",
+	[WL_OUTPUT_TRANSFORM_180] = "180",
+	[WL_OUTPUT_TRANSFORM_270] = "270",
+	[WL_OUTPUT_TRANSFORM_FLIPPED] = "flipped",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_90] = "flipped-90",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_180] = "flipped-180",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_270] = "flipped-270",
+};
+
+static void bench_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wlr_buffer_finish(wlr_buffer);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool bench_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*format = DRM_FORMAT_ARGB8888;
+	*data = buffer->data;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void bench_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+}
+
+static const struct wlr_buffer_impl bench_buffer_impl = {
+	.destroy = bench_buffer_destroy,
+	.begin_data_ptr_access = bench_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = bench_buffer_end_data_ptr_access,
+};
+
+static struct bench_buffer *bench_buffer_create(int width, int height) {
+	struct bench_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	wlr_buffer_init(&buffer->base, &bench_buffer_impl, width, height);
+
+	buffer->stride = width * 4;
+	buffer->data = calloc(height, buffer->stride);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+static void fill_pixels(struct bench_buffer *buffer, bool translucent) {
+	uint32_t *pixels = buffer->data;
+	uint64_t rng = rand_xorshift64_seed(1);
+	for (int i = 0; i < buffer->base.width * buffer->base.height; i++) {
+		uint32_t v = rand_xorshift64(&rng) >> 32;
+
+		// Keep the color channels premultiplied
+		uint32_t a = translucent ? v >> 24 : 0xFF;
+		uint32_t r = ((v >> 16) & 0xFF) * a / 0xFF;
+		uint32_t g = ((v >> 8) & 0xFF) * a / 0xFF;
+		uint32_t b = (v & 0xFF) * a / 0xFF;
+		pixels[i] = a << 24 | r << 16 | g << 8 | b;
+	}
+}
+
+static bool run_path(const struct bench_options *options, bool kernels,
+		struct bench_buffer *src, struct bench_buffer *dst,
+		struct samples *samples) {
+	if (kernels) {
+		unsetenv("WLR_PIXMAN_DISABLE_BLIT_KERNELS");
+	} else {
+		setenv("WLR_PIXMAN_DISABLE_BLIT_KERNELS", "1", true);
+	}
+
+	struct wlr_renderer *renderer = wlr_pixman_renderer_create();
+	if (renderer == NULL) {
+		return false;
+	}
+
+	bool ok = false;
+	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, &src->base);
+	if (texture == NULL) {
+		goto out;
+	}
+
+	for (int i = 0; i < options->frames; i++) {
+		// Start from the same background on every frame
+		fill_pixels(dst, false);
+
+		int64_t start = get_time_ns();
+
+		struct wlr_render_pass *pass =
+			wlr_renderer_begin_buffer_pass(renderer, &dst->base, NULL);
+		if (pass == NULL) {
+			goto out;
+		}
+		wlr_render_pass_add_texture(pass, &(struct wlr_render_texture_options){
+			.texture = texture,
+			.dst_box = { .width = options->width, .height = options->height },
+			.transform = options->transform,
+			.blend_mode = options->blend ?
+				WLR_RENDER_BLEND_MODE_PREMULTIPLIED : WLR_RENDER_BLEND_MODE_NONE,
+		});
+		if (!wlr_render_pass_submit(pass)) {
+			goto out;
+		}
+
+		samples_add(samples, get_time_ns() - start);
+	}
+
+	ok = true;
+
+out:
+	wlr_texture_destroy(texture);
+	wlr_renderer_destroy(renderer);
+	return ok;
+}
+
+static const char usage[] =
+	"usage: bench-pixman [options...]\n"
+	"  -t <name>   transform: normal, 90, 180, 270, flipped, flipped-90,\n"
+	"              flipped-180, flipped-270 (default: 90)\n"
+	"  -b          blend a translucent texture instead of copying it\n"
+	"  -f <count>  number of frames (default: 100)\n"
+	"  -W <width>  output width (default: 3840)\n"
+	"  -H <height> output height (default: 2160)\n"
+	"  -h          show this help message\n";
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench_options options = {
+		.width = 3840,
+		.height = 2160,
+		.frames = 100,
+		.transform = WL_OUTPUT_TRANSFORM_90,
+	};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:bf:W:H:h")) != -1) {
+		switch (opt) {
+		case 't':;
+			bool found = false;
+			for (size_t i = 0; i < sizeof(transform_names) / sizeof(transform_names[0]); i++) {
+				if (strcmp(optarg, transform_names[i]) == 0) {
+					options.transform = i;
+					found = true;
+				}
+			}
+			if (!found) {
+				fprintf(stderr, "Unknown transform: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			options.blend = true;
+			break;
+		case 'f':
+			options.frames = atoi(optarg);
+			break;
+		case 'W':
+			options.width = atoi(optarg);
+			break;
+		case 'H':
+			options.height = atoi(optarg);
+			break;
+		case 'h':
+			printf("%s", usage);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, "%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options.frames <= 0 || options.width <= 0 || options.height <= 0) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	// The texture is rotated to cover the whole output without scaling
+	int src_width = options.width, src_height = options.height;
+	if (options.transform % 2 != 0) {
+		src_width = options.height;
+		src_height = options.width;
+	}
+
+	struct bench_buffer *src = bench_buffer_create(src_width, src_height);
+	struct bench_buffer *generic_dst = bench_buffer_create(options.width, options.height);
+	struct bench_buffer *kernels_dst = bench_buffer_create(options.width, options.height);
+	struct samples generic = {0}, kernels = {0};
+
+	int ret = EXIT_FAILURE;
+	if (src == NULL || generic_dst == NULL || kernels_dst == NULL) {
+		fprintf(stderr, "Failed to set up the benchmark\n");
+		goto out;
+	}
+
+	fill_pixels(src, options.blend);
+
+	if (!run_path(&options, false, src, generic_dst, &generic) ||
+			!run_path(&options, true, src, kernels_dst, &kernels)) {
+		fprintf(stderr, "Failed to render\n");
+		goto out;
+	}
+
+	bool identical = memcmp(generic_dst->data, kernels_dst->data,
+		kernels_dst->stride * options.height) == 0;
+
+	printf("{\"transform\":\"%s\",\"width\":%d,\"height\":%d,\"blend\":%s,",
+		transform_names[options.transform], options.width, options.height,
+		options.blend ? "true" : "false");
+	samples_print(&generic, "generic_ns");
+	printf(",");
+	samples_print(&kernels, "kernels_ns");
+	printf(",\"identical\":%s}\n", identical ? "true" : "false");
+
+	ret = identical ? EXIT_SUCCESS : EXIT_FAILURE;
+
+out:
+	if (src != NULL) {
+		wlr_buffer_drop(&src->base);
+	}
+	if (generic_dst != NULL) {
+		wlr_buffer_drop(&generic_dst->base);
+	}
+	if (kernels_dst != NULL) {
+		wlr_buffer_drop(&kernels_dst->base);
+	}
+	samples_finish(&generic);
+	samples_finish(&kernels);
+	return ret;
+}
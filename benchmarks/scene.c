@@ -0,0 +1,608 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+#include "common.h"
+#include "util/rand.h"
+
+/*
+ * Scene-graph benchmark driven by the headless backend and the pixman
+ * renderer.
+ *
+ * Each workload mutates the scene once per frame, then builds the output
+ * state and runs a batch of hit-tests. Results are printed as a single JSON
+ * object on stdout:
+ *
+ *  - update_ns: time spent applying the frame's scene mutations, which is
+ *    dominated by the visibility and damage updates (scene_update_region())
+ *  - build_state_ns: time spent in wlr_scene_output_build_state()
+ *  - node_at_ns: latency of a single wlr_scene_node_at() call
+ *  - allocs_per_frame: heap allocations performed per frame (-1 if allocation
+ *    counting isn't supported by the C library)
+ */
+
+static uint64_t alloc_count = 0;
+
+#ifdef __GLIBC__
+#define HAVE_ALLOC_COUNT 1
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+enum workload {
+	WORKLOAD_TOPLEVELS,
+	WORKLOAD_RESTACK,
+	WORKLOAD_POPUPS,
+	WORKLOAD_DAMAGE,
+	WORKLOAD_FRACTIONAL,
+	WORKLOAD_OCCLUSION,
+};
+
+static const char *workload_names[] = {
+	[WORKLOAD_TOPLEVELS] = "toplevels",
+	[WORKLOAD_RESTACK] = "restack",
+	[WORKLOAD_POPUPS] = "popups",
+	[WORKLOAD_DAMAGE] = "damage",
+	[WORKLOAD_FRACTIONAL] = "fractional",
+	[WORKLOAD_OCCLUSION] = "occlusion",
+};
+
+struct bench_options {
+	enum workload workload;
+	int toplevels;
+	int subsurfaces;
+	int frames;
+	int queries;
+	int popups;
+	int width, height;
+	float scale;
+	size_t layers;
+	int tile_size;
+	uint64_t seed;
+};
+
+struct bench_buffer {
+	struct wlr_buffer base;
+	void *data;
+	size_t stride;
+};
+
+struct toplevel {
+	struct wlr_scene_tree *tree;
+	struct wlr_scene_buffer *main;
+};
+
+struct bench {
+	struct bench_options options;
+	uint64_t rng;
+
+	struct wl_event_loop *event_loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_output *output;
+
+	struct wlr_scene *scene;
+	struct wlr_scene_output *scene_output;
+	struct wlr_scene_tree *popup_tree;
+
+	struct bench_buffer *toplevel_buffer;
+	struct bench_buffer *subsurface_buffer;
+	struct bench_buffer *popup_buffer;
+
+	struct toplevel *toplevels;
+};
+
+static uint32_t bench_rand(struct bench *bench) {
+	return rand_xorshift64(&bench->rng) >> 32;
+}
+
+static int bench_rand_range(struct bench *bench, int max) {
+	if (max <= 0) {
+		return 0;
+	}
+	return bench_rand(bench) % max;
+}
+
+static void bench_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wlr_buffer_finish(wlr_buffer);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool bench_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+		return false;
+	}
+
+	*format = DRM_FORMAT_ARGB8888;
+	*data = buffer->data;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void bench_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+}
+
+static const struct wlr_buffer_impl bench_buffer_impl = {
+	.destroy = bench_buffer_destroy,
+	.begin_data_ptr_access = bench_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = bench_buffer_end_data_ptr_access,
+};
+
+static struct bench_buffer *bench_buffer_create(int width, int height,
+		uint32_t color) {
+	struct bench_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	wlr_buffer_init(&buffer->base, &bench_buffer_impl, width, height);
+
+	buffer->stride = width * 4;
+	buffer->data = malloc(buffer->stride * height);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+
+	uint32_t *pixels = buffer->data;
+	for (int i = 0; i < width * height; i++) {
+		pixels[i] = color;
+	}
+
+	return buffer;
+}
+
+static void random_position(struct bench *bench, struct wlr_scene_node *node,
+		int width, int height) {
+	int x = bench_rand_range(bench, bench->options.width - width / 2);
+	int y = bench_rand_range(bench, bench->options.height - height / 2);
+	wlr_scene_node_set_position(node, x, y);
+}
+
+static bool bench_init_scene(struct bench *bench) {
+	struct bench_options *options = &bench->options;
+
+	bench->toplevel_buffer = bench_buffer_create(640, 480, 0xFF336699);
+	bench->subsurface_buffer = bench_buffer_create(64, 64, 0x80FFFFFF);
+	bench->popup_buffer = bench_buffer_create(200, 300, 0xFFEEEEEE);
+	if (bench->toplevel_buffer == NULL || bench->subsurface_buffer == NULL ||
+			bench->popup_buffer == NULL) {
+		return false;
+	}
+
+	bench->scene = wlr_scene_create();
+	if (bench->scene == NULL) {
+		return false;
+	}
+
+	float background_color[4] = { 0.2, 0.2, 0.2, 1 };
+	wlr_scene_rect_create(&bench->scene->tree, options->width,
+		options->height, background_color);
+
+	bench->toplevels = calloc(options->toplevels, sizeof(*bench->toplevels));
+	if (options->toplevels > 0 && bench->toplevels == NULL) {
+		return false;
+	}
+
+	for (int i = 0; i < options->toplevels; i++) {
+		struct toplevel *toplevel = &bench->toplevels[i];
+		toplevel->tree = wlr_scene_tree_create(&bench->scene->tree);
+		toplevel->main = wlr_scene_buffer_create(toplevel->tree,
+			&bench->toplevel_buffer->base);
+		if (toplevel->tree == NULL || toplevel->main == NULL) {
+			return false;
+		}
+
+		for (int j = 0; j < options->subsurfaces; j++) {
+			struct wlr_scene_buffer *subsurface = wlr_scene_buffer_create(
+				toplevel->tree, &bench->subsurface_buffer->base);
+			if (subsurface == NULL) {
+				return false;
+			}
+			// Lay sub-surfaces out on a grid within the main surface
+			wlr_scene_node_set_position(&subsurface->node,
+				(j % 8) * 72, (j / 8 % 6) * 72);
+		}
+
+		random_position(bench, &toplevel->tree->node, 640, 480);
+
+		if (options->workload == WORKLOAD_OCCLUSION) {
+			// Stack all windows on top of each other, fully opaque
+			pixman_region32_t opaque;
+			pixman_region32_init_rect(&opaque, 0, 0, 640, 480);
+			wlr_scene_buffer_set_opaque_region(toplevel->main, &opaque);
+			pixman_region32_fini(&opaque);
+
+			wlr_scene_node_set_position(&toplevel->tree->node,
+				(options->width - 640) / 2 + i % 16, (options->height - 480) / 2 + i % 16);
+		}
+	}
+
+	bench->popup_tree = wlr_scene_tree_create(&bench->scene->tree);
+	if (bench->popup_tree == NULL) {
+		return false;
+	}
+
+	bench->scene_output = wlr_scene_output_create(bench->scene, bench->output);
+	if (bench->scene_output == NULL) {
+		return false;
+	}
+
+	wlr_scene_output_set_damage_tile_size(bench->scene_output, options->tile_size);
+	return true;
+}
+
+static bool bench_init(struct bench *bench) {
+	bench->event_loop = wl_event_loop_create();
+	if (bench->event_loop == NULL) {
+		return false;
+	}
+
+	bench->backend = wlr_headless_backend_create(bench->event_loop);
+	if (bench->backend == NULL) {
+		return false;
+	}
+
+	bench->renderer = wlr_pixman_renderer_create();
+	if (bench->renderer == NULL) {
+		return false;
+	}
+
+	bench->allocator = wlr_allocator_autocreate(bench->backend, bench->renderer);
+	if (bench->allocator == NULL) {
+		return false;
+	}
+
+	if (!wlr_backend_start(bench->backend)) {
+		return false;
+	}
+
+	bench->output = wlr_headless_add_output(bench->backend,
+		bench->options.width, bench->options.height);
+	if (bench->output == NULL) {
+		return false;
+	}
+
+	if (!wlr_output_init_render(bench->output, bench->allocator, bench->renderer)) {
+		return false;
+	}
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	wlr_output_state_set_scale(&state, bench->options.scale);
+	bool ok = wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		return false;
+	}
+
+	// The scene is laid out in logical coordinates
+	wlr_output_effective_resolution(bench->output,
+		&bench->options.width, &bench->options.height);
+
+	return bench_init_scene(bench);
+}
+
+static void bench_finish(struct bench *bench) {
+	if (bench->scene != NULL) {
+		wlr_scene_node_destroy(&bench->scene->tree.node);
+	}
+	if (bench->backend != NULL) {
+		wlr_backend_destroy(bench->backend);
+	}
+	if (bench->allocator != NULL) {
+		wlr_allocator_destroy(bench->allocator);
+	}
+	if (bench->renderer != NULL) {
+		wlr_renderer_destroy(bench->renderer);
+	}
+	if (bench->event_loop != NULL) {
+		wl_event_loop_destroy(bench->event_loop);
+	}
+
+	struct bench_buffer *buffers[] = {
+		bench->toplevel_buffer,
+		bench->subsurface_buffer,
+		bench->popup_buffer,
+	};
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+		if (buffers[i] != NULL) {
+			wlr_buffer_drop(&buffers[i]->base);
+		}
+	}
+
+	free(bench->toplevels);
+}
+
+static struct toplevel *random_toplevel(struct bench *bench) {
+	if (bench->options.toplevels == 0) {
+		return NULL;
+	}
+	return &bench->toplevels[bench_rand_range(bench, bench->options.toplevels)];
+}
+
+static void bench_update(struct bench *bench) {
+	struct toplevel *toplevel;
+
+	switch (bench->options.workload) {
+	case WORKLOAD_TOPLEVELS:
+	case WORKLOAD_FRACTIONAL:
+		// Interactive move of a single window
+		toplevel = random_toplevel(bench);
+		if (toplevel != NULL) {
+			random_position(bench, &toplevel->tree->node, 640, 480);
+		}
+		break;
+	case WORKLOAD_RESTACK:
+		for (int i = 0; i < 4; i++) {
+			toplevel = random_toplevel(bench);
+			if (toplevel != NULL) {
+				wlr_scene_node_raise_to_top(&toplevel->tree->node);
+			}
+		}
+		break;
+	case WORKLOAD_POPUPS:;
+		struct wlr_scene_node *child, *child_tmp;
+		wl_list_for_each_safe(child, child_tmp, &bench->popup_tree->children, link) {
+			wlr_scene_node_destroy(child);
+		}
+
+		for (int i = 0; i < bench->options.popups; i++) {
+			struct wlr_scene_buffer *popup = wlr_scene_buffer_create(
+				bench->popup_tree, &bench->popup_buffer->base);
+			if (popup != NULL) {
+				random_position(bench, &popup->node, 200, 300);
+			}
+		}
+		break;
+	case WORKLOAD_DAMAGE:
+		for (int i = 0; i < 8; i++) {
+			toplevel = random_toplevel(bench);
+			if (toplevel == NULL) {
+				break;
+			}
+
+			pixman_region32_t damage;
+			pixman_region32_init_rect(&damage,
+				bench_rand_range(bench, 640 - 32), bench_rand_range(bench, 480 - 32),
+				32, 32);
+			wlr_scene_buffer_set_buffer_with_damage(toplevel->main,
+				&bench->toplevel_buffer->base, &damage);
+			pixman_region32_fini(&damage);
+		}
+		break;
+	case WORKLOAD_OCCLUSION:
+		// Small changes at the bottom of a deep stack of overlapping windows
+		if (bench->options.toplevels > 0) {
+			struct wlr_scene_node *node = &bench->toplevels[0].tree->node;
+			wlr_scene_node_set_position(node, node->x + (bench_rand(bench) % 2 ? 1 : -1),
+				node->y + (bench_rand(bench) % 2 ? 1 : -1));
+		}
+		break;
+	}
+}
+
+static int bench_run(struct bench *bench) {
+	struct samples update = {0}, build_state = {0}, node_at = {0};
+	uint64_t total_allocs = 0;
+
+	for (int frame = 0; frame < bench->options.frames; frame++) {
+		uint64_t allocs_start = alloc_count;
+
+		int64_t start = get_time_ns();
+		bench_update(bench);
+		samples_add(&update, get_time_ns() - start);
+
+		struct wlr_output_state state;
+		wlr_output_state_init(&state);
+
+		start = get_time_ns();
+		struct wlr_scene_output_state_options state_options = {
+			.max_layers = bench->options.layers,
+		};
+		bool ok = wlr_scene_output_build_state(bench->scene_output, &state,
+			&state_options);
+		samples_add(&build_state, get_time_ns() - start);
+
+		if (!ok || !wlr_output_commit_state(bench->output, &state)) {
+			wlr_output_state_finish(&state);
+			fprintf(stderr, "Failed to commit frame %d\n", frame);
+			return EXIT_FAILURE;
+		}
+		wlr_output_state_finish(&state);
+
+		for (int i = 0; i < bench->options.queries; i++) {
+			double lx = bench_rand_range(bench, bench->options.width) + 0.5;
+			double ly = bench_rand_range(bench, bench->options.height) + 0.5;
+
+			start = get_time_ns();
+			wlr_scene_node_at(&bench->scene->tree.node, lx, ly, NULL, NULL);
+			samples_add(&node_at, get_time_ns() - start);
+		}
+
+		total_allocs += alloc_count - allocs_start;
+
+		// Deliver the present events queued by the headless backend
+		wl_event_loop_dispatch(bench->event_loop, 0);
+	}
+
+	struct bench_options *options = &bench->options;
+	printf("{\"workload\":\"%s\",\"toplevels\":%d,\"subsurfaces\":%d,"
+		"\"popups\":%d,\"frames\":%d,\"width\":%d,\"height\":%d,\"scale\":%g,"
+		"\"layers\":%zu,\"tile_size\":%d,",
+		workload_names[options->workload], options->toplevels,
+		options->subsurfaces, options->popups, options->frames,
+		options->width, options->height, options->scale, options->layers,
+		options->tile_size);
+	samples_print(&update, "update_ns");
+	printf(",");
+	samples_print(&build_state, "build_state_ns");
+	printf(",");
+	samples_print(&node_at, "node_at_ns");
+	if (HAVE_ALLOC_COUNT && options->frames > 0) {
+		printf(",\"allocs_per_frame\":%.1f}\n",
+			(double)total_allocs / options->frames);
+	} else {
+		printf(",\"allocs_per_frame\":-1}\n");
+	}
+
+	samples_finish(&update);
+	samples_finish(&build_state);
+	samples_finish(&node_at);
+	return EXIT_SUCCESS;
+}
+
+static const char usage[] =
+	"usage: bench-scene [options...]\n"
+	"  -w <name>   workload: toplevels, restack, popups, damage, fractional,\n"
+	"              occlusion\n"
+	"  -n <count>  number of toplevels (default: 200)\n"
+	"  -m <count>  number of sub-surfaces per toplevel (default: 4)\n"
+	"  -p <count>  number of popups per frame (default: 50)\n"
+	"  -f <count>  number of frames (default: 300)\n"
+	"  -q <count>  number of hit-tests per frame (default: 100)\n"
+	"  -s <scale>  output scale (default: 1, or 1.5 for fractional)\n"
+	"  -W <width>  output width (default: 3840)\n"
+	"  -H <height> output height (default: 2160)\n"
+	"  -l <count>  maximum number of output layers (default: 0)\n"
+	"  -t <size>   track damage with tiles of this size (default: 0, regions)\n"
+	"  -r <seed>   random seed (default: 1)\n"
+	"  -h          show this help message\n";
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench bench = {
+		.options = {
+			.workload = WORKLOAD_TOPLEVELS,
+			.toplevels = 200,
+			.subsurfaces = 4,
+			.popups = 50,
+			.frames = 300,
+			.queries = 100,
+			.width = 3840,
+			.height = 2160,
+			.scale = 0,
+			.seed = 1,
+		},
+	};
+	struct bench_options *options = &bench.options;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "w:n:m:p:f:q:s:W:H:l:t:r:h")) != -1) {
+		switch (opt) {
+		case 'w':;
+			bool found = false;
+			for (size_t i = 0; i < sizeof(workload_names) / sizeof(workload_names[0]); i++) {
+				if (strcmp(optarg, workload_names[i]) == 0) {
+					options->workload = i;
+					found = true;
+				}
+			}
+			if (!found) {
+				fprintf(stderr, "Unknown workload: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			options->toplevels = atoi(optarg);
+			break;
+		case 'm':
+			options->subsurfaces = atoi(optarg);
+			break;
+		case 'p':
+			options->popups = atoi(optarg);
+			break;
+		case 'f':
+			options->frames = atoi(optarg);
+			break;
+		case 'q':
+			options->queries = atoi(optarg);
+			break;
+		case 's':
+			options->scale = strtof(optarg, NULL);
+			break;
+		case 'W':
+			options->width = atoi(optarg);
+			break;
+		case 'H':
+			options->height = atoi(optarg);
+			break;
+		case 'l':
+			options->layers = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			options->tile_size = atoi(optarg);
+			break;
+		case 'r':
+			options->seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'h':
+			printf("%s", usage);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, "%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options->scale <= 0) {
+		options->scale = options->workload == WORKLOAD_FRACTIONAL ? 1.5 : 1;
+	}
+	if (options->toplevels < 0 || options->subsurfaces < 0 ||
+			options->popups < 0 || options->frames < 0 || options->queries < 0 ||
+			options->width <= 0 || options->height <= 0 ||
+			options->tile_size < 0) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	bench.rng = rand_xorshift64_seed(options->seed);
+
+	int ret = EXIT_FAILURE;
+	if (bench_init(&bench)) {
+		ret = bench_run(&bench);
+	} else {
+		fprintf(stderr, "Failed to set up the benchmark\n");
+	}
+
+	bench_finish(&bench);
+	return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef BACKEND_DRM_BLOB_CACHE_H
+#define BACKEND_DRM_BLOB_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+struct wlr_drm_backend;
+
+/**
+ * Property blobs, looked up by content.
+ *
+ * Blobs are immutable, so identical mode, gamma LUT or damage clips blobs can
+ * be shared between commits and CRTCs. Each user holds a reference. Blobs
+ * without any reference are kept around for re-use, up to a limit.
+ */
+struct wlr_drm_blob_cache {
+	struct wl_list entries; // wlr_drm_blob_cache_entry.link, most recent first
+	size_t entries_len;
+};
+
+void drm_blob_cache_init(struct wlr_drm_blob_cache *cache);
+/**
+ * Destroy all blobs, including the referenced ones.
+ */
+void drm_blob_cache_finish(struct wlr_drm_blob_cache *cache,
+	struct wlr_drm_backend *drm);
+/**
+ * Get a reference to a blob with the given contents, creating it if
+ * necessary.
+ */
+bool drm_blob_cache_acquire(struct wlr_drm_backend *drm,
+	const void *data, size_t size, uint32_t *blob_id);
+/**
+ * Release a reference to a blob. Blobs which don't belong to the cache are
+ * destroyed right away. Zero is a no-op.
+ */
+void drm_blob_cache_release(struct wlr_drm_backend *drm, uint32_t blob_id);
+
+#endif
@@ -11,9 +11,11 @@
 #include <wlr/render/drm_format_set.h>
 #include <wlr/types/wlr_output_layer.h>
 #include <xf86drmMode.h>
+#include "backend/drm/blob_cache.h"
 #include "backend/drm/iface.h"
 #include "backend/drm/properties.h"
 #include "backend/drm/renderer.h"
+#include "backend/drm/test_cache.h"
 
 struct wlr_drm_viewport {
 	struct wlr_fbox src_box;
@@ -125,6 +127,9 @@ struct wlr_drm_backend {
 	struct wlr_drm_format_set mgpu_formats;
 
 	bool supports_tearing_page_flips;
+
+	struct wlr_drm_test_cache test_cache;
+	struct wlr_drm_blob_cache blob_cache;
 };
 
 struct wlr_drm_mode {
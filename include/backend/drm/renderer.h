@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <wlr/backend.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_damage_ring.h>
 #include <wlr/util/addon.h>
 
 struct wlr_drm_backend;
@@ -23,6 +24,9 @@ struct wlr_drm_surface {
 
 	struct wlr_drm_syncobj_timeline *timeline;
 	uint64_t point;
+
+	// Tracks which parts of the swapchain buffers are out of date
+	struct wlr_damage_ring damage_ring;
 };
 
 bool init_drm_renderer(struct wlr_drm_backend *drm,
@@ -34,8 +38,12 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 	const struct wlr_drm_format *drm_format);
 void finish_drm_surface(struct wlr_drm_surface *surf);
 
+/**
+ * Copy a buffer into the surface's next swapchain buffer. damage is the
+ * difference with the previously blitted buffer, or NULL if unknown.
+ */
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-	struct wlr_buffer *buffer,
+	struct wlr_buffer *buffer, const pixman_region32_t *damage,
 	struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point);
 
 bool drm_plane_pick_render_format(struct wlr_drm_plane *plane,
@@ -0,0 +1,48 @@
+#ifndef BACKEND_DRM_TEST_CACHE_H
+#define BACKEND_DRM_TEST_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+struct wlr_drm_backend;
+struct wlr_drm_device_state;
+
+/**
+ * Results of previous test-only atomic commits.
+ *
+ * Compositors test the same configurations over and over (e.g. direct scanout
+ * of a fullscreen client on every frame). Entries are keyed by the plane and
+ * CRTC configuration rather than by raw KMS property values, since blob IDs
+ * and fences change on every commit.
+ */
+struct wlr_drm_test_cache {
+	bool enabled;
+	struct wl_list entries; // wlr_drm_test_cache_entry.link, most recent first
+	size_t entries_len;
+	uint64_t hits, misses;
+};
+
+void drm_test_cache_init(struct wlr_drm_test_cache *cache);
+void drm_test_cache_finish(struct wlr_drm_test_cache *cache);
+/**
+ * Drop all entries, e.g. after a modeset or a hotplug.
+ */
+void drm_test_cache_clear(struct wlr_drm_test_cache *cache);
+/**
+ * Build the cache key of a device state. The key includes the committed
+ * primary and cursor planes of the device's other CRTCs. Returns false if the
+ * state can't be cached.
+ */
+bool drm_test_cache_build_key(struct wl_array *key, struct wlr_drm_backend *drm,
+	const struct wlr_drm_device_state *state, uint32_t flags);
+/**
+ * Look up the result of a previous test. Returns false on a cache miss.
+ */
+bool drm_test_cache_lookup(struct wlr_drm_test_cache *cache,
+	const struct wl_array *key, bool *ok);
+void drm_test_cache_insert(struct wlr_drm_test_cache *cache,
+	const struct wl_array *key, bool ok);
+
+#endif
@@ -12,6 +12,14 @@ struct wlr_headless_backend {
 	struct wl_list outputs;
 	struct wl_listener event_loop_destroy;
 	bool started;
+
+	// Maximum number of output layers accepted per output, used to emulate
+	// the limited amount of hardware planes
+	size_t max_output_layers;
+
+	// Initial timing behavior of new outputs
+	struct wlr_headless_output_timing default_timing;
+	uint64_t seed;
 };
 
 struct wlr_headless_output {
@@ -21,7 +29,19 @@ struct wlr_headless_output {
 	struct wl_list link;
 
 	struct wl_event_source *frame_timer;
-	int frame_delay; // ms
+
+	struct wlr_headless_output_timing timing;
+	uint64_t rng;
+
+	// Simulated display clock: time and sequence number of the last vblank
+	int64_t refresh_ns;
+	int64_t vblank_ns;
+	unsigned vblank_seq;
+
+	// Page-flip waiting for its vblank
+	bool flip_pending;
+	int64_t flip_ns;
+	struct wlr_output_event_present flip_present;
 };
 
 struct wlr_headless_backend *headless_backend_from_backend(
@@ -1,11 +1,16 @@
 #ifndef RENDER_PIXMAN_H
 #define RENDER_PIXMAN_H
 
+#include <pthread.h>
+#include <time.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/box.h>
 #include "render/pixel_format.h"
+#include "util/rect_union.h"
 
 struct wlr_pixman_pixel_format {
 	uint32_t drm_format;
@@ -14,13 +19,52 @@ struct wlr_pixman_pixel_format {
 
 struct wlr_pixman_buffer;
 
+// Each level halves the size of the previous one
+#define PIXMAN_DOWNSCALE_MAX_LEVELS 8
+
+typedef void (*wlr_pixman_worker_func_t)(void *data);
+
+/**
+ * A fixed pool of threads used to replay render passes in parallel. The
+ * thread calling pixman_workers_run() participates in the work as well.
+ */
+struct wlr_pixman_workers {
+	pthread_t *threads;
+	size_t n_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	uint64_t generation;
+	size_t busy;
+	bool stop;
+
+	wlr_pixman_worker_func_t func;
+	void *data;
+};
+
+enum wlr_pixman_lut3d_interpolation {
+	PIXMAN_LUT3D_TETRAHEDRAL,
+	PIXMAN_LUT3D_TRILINEAR,
+};
+
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
 
 	struct wl_list buffers; // wlr_pixman_buffer.link
 	struct wl_list textures; // wlr_pixman_texture.link
+	struct wl_list color_transforms; // wlr_pixman_color_transform.link
 
 	struct wlr_drm_format_set drm_formats;
+
+	// NULL if render passes are executed on the calling thread
+	struct wlr_pixman_workers *workers;
+	bool blit_kernels;
+	enum wlr_pixman_lut3d_interpolation lut3d_interpolation;
+	bool color_transform_format_warned;
+
+	// Memory used by downscaled textures, in bytes
+	size_t downscale_size, max_downscale_size;
+	struct wl_list downscale_lru; // wlr_pixman_texture.downscale.link
 };
 
 struct wlr_pixman_buffer {
@@ -44,11 +88,75 @@ struct wlr_pixman_texture {
 
 	void *data; // if created via texture_from_pixels
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
+
+	struct {
+		// levels[i] is downscaled by a factor of 2^(i + 1)
+		pixman_image_t *levels[PIXMAN_DOWNSCALE_MAX_LEVELS];
+		size_t n_levels;
+		size_t size; // in bytes
+		pixman_region32_t damage; // texture-local coordinates
+		int minified_draws;
+		struct wl_list link; // wlr_pixman_renderer.downscale_lru
+	} downscale;
+};
+
+/**
+ * A 3D LUT output color transform, prepared for 8-bit sRGB-encoded input.
+ */
+struct wlr_pixman_color_transform {
+	struct wlr_addon addon; // wlr_color_transform.addons
+	struct wl_list link; // wlr_pixman_renderer.color_transforms
+
+	size_t dim_len;
+	uint16_t *lut_3d; // RGB triplets
+	size_t stride[3]; // distance between two entries along each axis
+	// Offset of the lower LUT entry and interpolation weight towards the
+	// upper one, for each channel value
+	uint32_t offset[3][256];
+	uint32_t weight[256];
+};
+
+/**
+ * A single compositing operation. Used to execute operations immediately,
+ * and to record them for a threaded replay at submit time.
+ */
+struct wlr_pixman_render_op {
+	pixman_op_t op;
+	pixman_region32_t clip; // only used for recorded operations
+
+	pixman_image_t *image; // NULL for solid fills
+	pixman_color_t color; // if image is NULL
+	bool has_transform;
+	struct pixman_transform transform;
+	pixman_filter_t filter;
+	bool blit_kernels; // try pixman_blit_transformed() first
+
+	bool has_mask;
+	uint16_t mask_alpha;
+
+	int32_t src_x, src_y;
+	struct wlr_box dst_box;
+};
+
+struct wlr_pixman_render_timer {
+	struct wlr_render_timer base;
+	// Rendering is synchronous: the pass is complete once submitted
+	struct timespec start, end;
+	bool complete;
 };
 
 struct wlr_pixman_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_pixman_buffer *buffer;
+	struct wlr_pixman_render_timer *timer;
+
+	// Only used if the renderer has workers
+	struct wl_array ops; // struct wlr_pixman_render_op
+	struct wl_array accessed_buffers; // struct wlr_buffer *
+
+	// Only used with a 3D LUT color transform
+	struct wlr_pixman_color_transform *color_transform;
+	struct rect_union updated;
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
@@ -58,7 +166,57 @@ const uint32_t *get_pixman_drm_formats(size_t *len);
 bool begin_pixman_data_ptr_access(struct wlr_buffer *buffer, pixman_image_t **image_ptr,
 	uint32_t flags);
 
+struct wlr_pixman_render_timer *pixman_get_render_timer(
+	struct wlr_render_timer *timer);
+
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-	struct wlr_pixman_buffer *buffer);
+	struct wlr_pixman_buffer *buffer,
+	struct wlr_pixman_color_transform *color_transform,
+	struct wlr_pixman_render_timer *timer);
+
+struct wlr_pixman_color_transform *pixman_color_transform_get_or_create(
+	struct wlr_pixman_renderer *renderer, struct wlr_color_transform *base);
+void pixman_color_transform_destroy(struct wlr_pixman_color_transform *transform);
+bool pixman_color_transform_supports_format(pixman_format_code_t format);
+/**
+ * Apply the color transform in-place to the pixels of the region.
+ */
+void pixman_color_transform_apply(const struct wlr_pixman_color_transform *transform,
+	enum wlr_pixman_lut3d_interpolation interpolation,
+	pixman_image_t *image, const pixman_region32_t *region);
+
+/**
+ * Execute a rotated or flipped operation without scaling using dedicated
+ * kernels. Returns false if the operation isn't supported, in which case
+ * nothing has been drawn.
+ */
+bool pixman_blit_transformed(const struct wlr_pixman_render_op *op,
+	pixman_image_t *src, pixman_image_t *dst, const pixman_region32_t *clip);
+
+void pixman_texture_init_downscaled(struct wlr_pixman_texture *texture);
+void pixman_texture_finish_downscaled(struct wlr_pixman_texture *texture);
+/**
+ * Get a copy of the texture downscaled by a factor of 2^level, creating it
+ * if necessary. If the cache is full, a larger level may be returned, and
+ * level is updated accordingly. Returns NULL if the texture doesn't qualify,
+ * in which case the full-size image should be used. The texture data must be
+ * accessible.
+ */
+pixman_image_t *pixman_texture_get_downscaled(struct wlr_pixman_texture *texture,
+	int *level);
+/**
+ * Mark a region of the texture as changed.
+ */
+void pixman_texture_damage_downscaled(struct wlr_pixman_texture *texture,
+	const pixman_region32_t *damage);
+
+struct wlr_pixman_workers *pixman_workers_create(size_t n_threads);
+void pixman_workers_destroy(struct wlr_pixman_workers *workers);
+/**
+ * Run func on every worker thread and on the calling thread, and wait for
+ * all of them to return.
+ */
+void pixman_workers_run(struct wlr_pixman_workers *workers,
+	wlr_pixman_worker_func_t func, void *data);
 
 #endif
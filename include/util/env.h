@@ -20,4 +20,12 @@ bool env_parse_bool(const char *option);
  */
 size_t env_parse_switch(const char *option, const char **switches);
 
+/**
+ * Parse a decimal integer between min and max from an environment variable.
+ *
+ * On success, the parsed value is returned. If the variable is unset or
+ * invalid, default_value is returned.
+ */
+long env_parse_long(const char *option, long min, long max, long default_value);
+
 #endif
@@ -0,0 +1,13 @@
+#ifndef UTIL_HASH_H
+#define UTIL_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Compute the 64-bit FNV-1a hash of a byte array. Not suitable for
+ * cryptographic use.
+ */
+uint64_t hash_fnv1a(const void *data, size_t size);
+
+#endif
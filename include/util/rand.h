@@ -0,0 +1,26 @@
+#ifndef UTIL_RAND_H
+#define UTIL_RAND_H
+
+#include <stdint.h>
+
+/**
+ * Seed a xorshift64* generator. The generator must not be seeded with zero,
+ * which is replaced with one.
+ */
+static inline uint64_t rand_xorshift64_seed(uint64_t seed) {
+	return seed != 0 ? seed : 1;
+}
+
+/**
+ * Advance a xorshift64* generator and return its next value. Unlike rand(),
+ * the sequence is the same with all C libraries, which keeps runs
+ * reproducible. The upper bits are the most random ones.
+ */
+static inline uint64_t rand_xorshift64(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ull;
+}
+
+#endif
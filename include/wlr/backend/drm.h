@@ -60,6 +60,19 @@ uint32_t wlr_drm_connector_get_id(struct wlr_output *output);
  */
 int wlr_drm_backend_get_non_master_fd(struct wlr_backend *backend);
 
+struct wlr_drm_test_cache_stats {
+	uint64_t hits, misses;
+};
+
+/**
+ * Get statistics about the cache of test-only atomic commit results.
+ *
+ * Both counters stay at zero when the cache is disabled (e.g. with the legacy
+ * interface or WLR_DRM_NO_TEST_CACHE).
+ */
+void wlr_drm_backend_get_test_cache_stats(struct wlr_backend *backend,
+	struct wlr_drm_test_cache_stats *stats);
+
 /**
  * Leases the given outputs to the caller. The outputs must be from the
  * associated DRM backend.
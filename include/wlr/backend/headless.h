@@ -25,6 +25,29 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_event_loop *loop);
 struct wlr_output *wlr_headless_add_output(struct wlr_backend *backend,
 	unsigned int width, unsigned int height);
 
+/**
+ * Timing behavior of the simulated display of a headless output.
+ */
+struct wlr_headless_output_timing {
+	// Lowest refresh rate in mHz when adaptive sync is enabled, the highest
+	// one being the mode's. Zero if adaptive sync isn't supported.
+	int32_t vrr_min_refresh;
+	// Maximum error of the presentation timestamps, in nanoseconds
+	int64_t jitter;
+	// Probability for a page-flip to miss its vblank, between 0 and 1
+	double missed_flip_rate;
+};
+
+/**
+ * Change the timing behavior of a headless output.
+ *
+ * Headless outputs present frames at the vblanks of a simulated display clock
+ * running at the refresh rate of the current mode. The initial timing
+ * behavior is read from environment variables, see docs/env_vars.md.
+ */
+void wlr_headless_output_set_timing(struct wlr_output *output,
+	const struct wlr_headless_output_timing *timing);
+
 bool wlr_backend_is_headless(struct wlr_backend *backend);
 bool wlr_output_is_headless(struct wlr_output *output);
 
@@ -30,6 +30,13 @@ struct wlr_renderer {
 	// enum wlr_buffer_cap)
 	uint32_t render_buffer_caps;
 
+	/**
+	 * Estimated overhead of drawing one more damage rectangle, expressed in
+	 * pixels. Damage regions are simplified by trading covered area for
+	 * fewer rectangles with this ratio, see struct wlr_damage_ring.
+	 */
+	uint32_t damage_rect_cost;
+
 	struct {
 		struct wl_signal destroy;
 		/**
@@ -17,24 +17,53 @@
 
 struct wlr_box;
 
+/**
+ * A bitmap of damaged tiles, one bit per tile, in rows of 64-bit words.
+ */
+struct wlr_damage_ring_tiles {
+	int width, height; // in tiles
+	uint64_t *bits;
+};
+
 struct wlr_damage_ring_buffer {
 	struct wlr_buffer *buffer;
+	// Empty if the ring tracks damage with tiles
 	pixman_region32_t damage;
 
 	struct wlr_damage_ring *ring;
 	struct wl_list link; // wlr_damage_ring.buffers
 
 	struct {
+		struct wlr_damage_ring_tiles tiles;
+
 		struct wl_listener destroy;
 	} WLR_PRIVATE;
 };
 
+/**
+ * The damage returned by wlr_damage_ring_rotate_buffer() is simplified by
+ * merging rectangles, as long as the extra area costs less than drawing the
+ * rectangles separately. rect_cost is the estimated cost of one rectangle, in
+ * pixels: compositors should set it to the wlr_renderer's damage_rect_cost.
+ *
+ * By default, damage is tracked with pixman regions. On very large outputs
+ * with scattered updates, wlr_damage_ring_set_tile_size() can switch the ring
+ * to a grid of tiles: damage is then rounded up to tile boundaries, but adding
+ * and accumulating it no longer depends on its complexity.
+ */
 struct wlr_damage_ring {
-	// Difference between the current buffer and the previous one
+	// Difference between the current buffer and the previous one. Empty if
+	// the ring tracks damage with tiles, see wlr_damage_ring_get_current().
 	pixman_region32_t current;
 
+	uint32_t rect_cost;
+
 	struct {
 		struct wl_list buffers; // wlr_damage_ring_buffer.link
+
+		int tile_size; // 0 if damage is tracked with regions
+		struct wlr_damage_ring_tiles current_tiles;
+		struct wlr_damage_ring_tiles accum_tiles;
 	} WLR_PRIVATE;
 };
 
@@ -42,6 +71,20 @@ void wlr_damage_ring_init(struct wlr_damage_ring *ring);
 
 void wlr_damage_ring_finish(struct wlr_damage_ring *ring);
 
+/**
+ * Track damage with a grid of tile_size x tile_size tiles, or with regions if
+ * tile_size is zero. Changing the tile size forgets the damage of previous
+ * buffers, so the next frame is fully damaged.
+ */
+void wlr_damage_ring_set_tile_size(struct wlr_damage_ring *ring, int tile_size);
+
+/**
+ * Get the difference between the current buffer and the previous one, in
+ * the buffer-local coordinate space.
+ */
+void wlr_damage_ring_get_current(const struct wlr_damage_ring *ring,
+	pixman_region32_t *damage);
+
 /**
  * Add a region to the current damage. The region must be in the buffer-local
  * coordinate space.
@@ -0,0 +1,96 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_FRAME_SCHEDULER_H
+#define WLR_TYPES_WLR_FRAME_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct wlr_output;
+struct wlr_render_timer;
+
+#define WLR_FRAME_SCHEDULER_HISTORY_LEN 16
+
+/**
+ * A frame scheduler delays the output's frame events to start rendering as
+ * late as possible before the next vblank, which reduces the latency between
+ * a client update and its display.
+ *
+ * The vblank phase is tracked from the output's present events, and the
+ * duration of the next frame is predicted from the durations reported with
+ * wlr_frame_scheduler_inform_render(). If the prediction turns out to be too
+ * short and a vblank is missed, the scheduler falls back to sending frame
+ * events right away for a while.
+ *
+ * Compositors should listen to the scheduler's frame event instead of the
+ * output's. The scheduler is destroyed along with its output: compositors
+ * must remove their listeners when the destroy event is emitted.
+ */
+struct wlr_frame_scheduler {
+	struct wlr_output *output;
+
+	// Time kept between the predicted end of rendering and the vblank, in
+	// nanoseconds
+	int64_t safety_margin;
+
+	struct {
+		struct wl_signal frame;
+		struct wl_signal destroy;
+	} events;
+
+	struct {
+		// Durations of the last frames, from the frame event to the end of
+		// rendering, in nanoseconds
+		int64_t durations[WLR_FRAME_SCHEDULER_HISTORY_LEN];
+		size_t durations_len, durations_index;
+
+		// Frame waiting to be presented
+		bool render_pending;
+		struct wlr_render_timer *render_timer;
+		int64_t cpu_duration;
+		uint32_t commit_seq;
+		int64_t commit_target; // vblank aimed at, zero if sent right away
+
+		int64_t last_present; // nanoseconds, zero if unknown
+		int64_t refresh; // nanoseconds, zero if unknown
+
+		int64_t target_vblank; // vblank aimed at by the last delayed frame
+		int fallback_frames; // frames to send right away after a miss
+
+		bool frame_queued;
+		struct wl_event_source *timer;
+
+		struct wl_listener output_frame;
+		struct wl_listener output_present;
+		struct wl_listener output_destroy;
+	} WLR_PRIVATE;
+};
+
+/**
+ * Create a frame scheduler for an output. It's destroyed with the output, see
+ * the destroy event.
+ */
+struct wlr_frame_scheduler *wlr_frame_scheduler_create(struct wlr_output *output);
+
+void wlr_frame_scheduler_destroy(struct wlr_frame_scheduler *scheduler);
+
+/**
+ * Inform the scheduler about the frame which has just been committed.
+ *
+ * cpu_duration is the time elapsed between the frame event and the commit,
+ * in nanoseconds. render_timer is optional: if set, the GPU time is added to
+ * the frame's duration once the frame is presented. The render timer must
+ * stay alive until the next call to this function or until the frame is
+ * presented.
+ */
+void wlr_frame_scheduler_inform_render(struct wlr_frame_scheduler *scheduler,
+	int64_t cpu_duration, struct wlr_render_timer *render_timer);
+
+#endif
@@ -51,6 +51,11 @@ typedef bool (*wlr_scene_buffer_point_accepts_input_func_t)(
 typedef void (*wlr_scene_buffer_iterator_func_t)(
 	struct wlr_scene_buffer *buffer, int sx, int sy, void *user_data);
 
+struct wlr_scene_timer_node_cost;
+
+typedef void (*wlr_scene_timer_node_iterator_func_t)(
+	const struct wlr_scene_timer_node_cost *cost, void *user_data);
+
 enum wlr_scene_node_type {
 	WLR_SCENE_NODE_TREE,
 	WLR_SCENE_NODE_RECT,
@@ -77,6 +82,13 @@ struct wlr_scene_node {
 
 	struct {
 		pixman_region32_t visible;
+		// Opaque region in node-local coordinates, re-computed lazily after
+		// the node is updated
+		pixman_region32_t opaque;
+		bool opaque_dirty;
+		// Whether the node is waiting for the pending scene transaction to
+		// be committed
+		bool transaction_pending;
 	} WLR_PRIVATE;
 };
 
@@ -91,6 +103,14 @@ struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	struct {
+		// Bounding box of all enabled descendants, relative to this node
+		struct wlr_box bounds;
+
+		bool cached;
+		struct wl_list caches; // struct scene_tree_cache.tree_link
+	} WLR_PRIVATE;
 };
 
 /** The root scene-graph node. */
@@ -112,6 +132,13 @@ struct wlr_scene {
 		bool direct_scanout;
 		bool calculate_visibility;
 		bool highlight_transparent_region;
+		bool spatial_index;
+
+		// See wlr_scene_transaction_begin()
+		int transaction_depth;
+		pixman_region32_t transaction_update_region;
+		pixman_region32_t transaction_damage;
+		struct wl_array transaction_nodes; // struct wlr_scene_node *
 	} WLR_PRIVATE;
 };
 
@@ -186,7 +213,11 @@ struct wlr_scene_buffer {
 	pixman_region32_t opaque_region;
 
 	struct {
+		// Set of outputs this buffer is displayed on, indexed by
+		// wlr_scene_output.index: the first 64 outputs are tracked in
+		// active_outputs, the others in active_outputs_ext (uint64_t words)
 		uint64_t active_outputs;
+		struct wl_array active_outputs_ext;
 		struct wlr_texture *texture;
 		struct wlr_linux_dmabuf_feedback_v1_init_options prev_feedback_options;
 
@@ -194,6 +225,11 @@ struct wlr_scene_buffer {
 		int buffer_width, buffer_height;
 		bool buffer_is_opaque;
 
+		// Single-pixel buffers are drawn as solid rects, the color is
+		// cached since the source buffer may be released
+		bool is_single_pixel_buffer;
+		float single_pixel_buffer_color[4];
+
 		struct wlr_drm_syncobj_timeline *wait_timeline;
 		uint64_t wait_point;
 
@@ -219,8 +255,11 @@ struct wlr_scene_output {
 
 	struct {
 		pixman_region32_t pending_commit_damage;
+		// Damage not yet applied to damage_ring and pending_commit_damage,
+		// in buffer-local coordinates
+		struct wl_array pending_damage; // pixman_box32_t
 
-		uint8_t index;
+		size_t index;
 		bool prev_scanout;
 
 		bool gamma_lut_changed;
@@ -233,15 +272,60 @@ struct wlr_scene_output {
 		struct wl_list damage_highlight_regions;
 
 		struct wl_array render_list;
+		// Set when the render list needs to be rebuilt because of a
+		// structural change in the scene-graph
+		bool render_list_dirty;
+		struct wlr_box render_list_box;
+		bool render_list_fractional_scale;
 
 		struct wlr_drm_syncobj_timeline *in_timeline;
 		uint64_t in_point;
+
+		// Output layers used to display buffers without compositing them
+		struct wl_array layers; // struct scene_output_layer
+		struct wl_array layer_states; // struct wlr_output_layer_state
+
+		struct wl_list tree_caches; // struct scene_tree_cache.output_link
 	} WLR_PRIVATE;
 };
 
+/**
+ * Measures the time spent rendering an output. The compositor must
+ * zero-initialize the timer before passing it to
+ * wlr_scene_output_build_state(), and call wlr_scene_timer_finish() once done
+ * with it. The timer can be re-used after wlr_scene_timer_finish().
+ */
 struct wlr_scene_timer {
 	int64_t pre_render_duration;
 	struct wlr_render_timer *render_timer;
+
+	/**
+	 * Record a breakdown of the CPU time spent rendering the frame. The
+	 * compositor sets this field, it is kept when the timer is re-used for
+	 * the next frame.
+	 */
+	bool profile_nodes;
+
+	// Populated when profile_nodes is set, in nanoseconds
+	int64_t render_list_duration;
+	int64_t damage_duration;
+
+	struct {
+		struct wl_array node_costs; // struct wlr_scene_timer_node_cost
+	} WLR_PRIVATE;
+};
+
+/**
+ * CPU time spent rendering a scene-graph node, see
+ * wlr_scene_timer_for_each_node().
+ */
+struct wlr_scene_timer_node_cost {
+	struct wlr_scene_node *node;
+	// Client owning the node's surface, or NULL
+	struct wl_client *client;
+	// Time spent recording the rendering operations for the node, and
+	// redrawing its contents if it's a cached tree
+	int64_t duration_ns;
 };
 
 /** A layer shell scene helper */
@@ -325,6 +409,28 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
  */
 struct wlr_scene *wlr_scene_create(void);
 
+/**
+ * Start a transaction on the scene-graph.
+ *
+ * Until the matching wlr_scene_transaction_commit() call, node changes only
+ * update the scene-graph structure: the visibility, output enter/leave and
+ * damage updates they require are deferred and merged together. This is
+ * useful when many nodes are changed at once, for instance when re-arranging
+ * tiled windows.
+ *
+ * Transactions can be nested, the deferred work is performed when the
+ * outermost transaction is committed. Outputs shouldn't be rendered while a
+ * transaction is pending, since node visibility isn't up-to-date.
+ */
+void wlr_scene_transaction_begin(struct wlr_scene *scene);
+/**
+ * Commit a transaction started with wlr_scene_transaction_begin().
+ *
+ * The resulting node visibility and output damage are the same as if the
+ * changes had been applied outside of a transaction.
+ */
+void wlr_scene_transaction_commit(struct wlr_scene *scene);
+
 /**
  * Handles linux_dmabuf_v1 feedback for all surfaces in the scene.
  *
@@ -347,6 +453,19 @@ void wlr_scene_set_gamma_control_manager_v1(struct wlr_scene *scene,
  */
 struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent);
 
+/**
+ * Enable or disable caching of the contents of a tree.
+ *
+ * When enabled, the descendants of the tree are rendered into an offscreen
+ * buffer for each output, which is then composited as a single texture. The
+ * buffer is only redrawn when a descendant is damaged. This is suited for
+ * complex sub-trees which rarely change, e.g. panels or server-side
+ * decorations.
+ *
+ * Descendants of a cached tree are never directly scanned out.
+ */
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached);
+
 /**
  * Add a node displaying a single surface to the scene-graph.
  *
@@ -536,6 +655,15 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output);
 void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	int lx, int ly);
 
+/**
+ * Track the output's damage with a grid of tile_size x tile_size tiles
+ * instead of regions, or with regions again if tile_size is zero. This is
+ * cheaper for very high resolution outputs with many scattered updates, at
+ * the cost of re-rendering whole tiles. See wlr_damage_ring_set_tile_size().
+ */
+void wlr_scene_output_set_damage_tile_size(struct wlr_scene_output *scene_output,
+	int tile_size);
+
 struct wlr_scene_output_state_options {
 	struct wlr_scene_timer *timer;
 	struct wlr_color_transform *color_transform;
@@ -546,6 +674,17 @@ struct wlr_scene_output_state_options {
 	 * wlr_output_state or output size if not specified.
 	 */
 	struct wlr_swapchain *swapchain;
+
+	/**
+	 * Maximum number of buffers which may be displayed with output layers
+	 * instead of being composited. The topmost eligible buffers are offered
+	 * to the backend, and the ones it rejects are composited as usual. Zero
+	 * disables output layers.
+	 *
+	 * Output layers must be disabled when the full output contents need to
+	 * be composited onto a single buffer, e.g. during screen capture.
+	 */
+	size_t max_layers;
 };
 
 /**
@@ -575,6 +714,17 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 int64_t wlr_scene_timer_get_duration_ns(struct wlr_scene_timer *timer);
 void wlr_scene_timer_finish(struct wlr_scene_timer *timer);
 
+/**
+ * Call `iterator` on each node rendered during the last frame measured by the
+ * timer, from the bottom to the top of the output. Requires
+ * wlr_scene_timer.profile_nodes.
+ *
+ * The node and client pointers are not referenced: this must be called before
+ * the scene-graph is modified, e.g. right after wlr_scene_output_commit().
+ */
+void wlr_scene_timer_for_each_node(struct wlr_scene_timer *timer,
+	wlr_scene_timer_node_iterator_func_t iterator, void *user_data);
+
 /**
  * Call wlr_surface_send_frame_done() on all surfaces in the scene rendered by
  * wlr_scene_output_commit() for which wlr_scene_surface.primary_output
@@ -10,6 +10,7 @@
 #define WLR_TYPES_WLR_SINGLE_PIXEL_BUFFER_V1_H
 
 #include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
 
 struct wlr_single_pixel_buffer_manager_v1 {
 	struct wl_global *global;
@@ -19,8 +20,29 @@ struct wlr_single_pixel_buffer_manager_v1 {
 	} WLR_PRIVATE;
 };
 
+/**
+ * A buffer made of a single pixel, created with the single-pixel-buffer-v1
+ * protocol.
+ */
+struct wlr_single_pixel_buffer_v1 {
+	struct wlr_buffer base;
+	struct wl_resource *resource;
+	// Pre-multiplied color channels
+	uint32_t r, g, b, a;
+	uint8_t argb8888[4]; // packed little-endian DRM_FORMAT_ARGB8888
+
+	struct {
+		struct wl_listener release;
+	} WLR_PRIVATE;
+};
 
 struct wlr_single_pixel_buffer_manager_v1 *wlr_single_pixel_buffer_manager_v1_create(
 	struct wl_display *display);
 
+/**
+ * If the buffer is a single-pixel buffer, return it. Otherwise, return NULL.
+ */
+struct wlr_single_pixel_buffer_v1 *wlr_single_pixel_buffer_v1_try_from_buffer(
+	struct wlr_buffer *buffer);
+
 #endif
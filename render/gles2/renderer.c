@@ -526,6 +526,9 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		return NULL;
 	}
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl, WLR_BUFFER_CAP_DMABUF);
+	// Each rectangle costs a scissor change and a draw call, while pixels are
+	// almost free
+	renderer->wlr_renderer.damage_rect_cost = 128 * 128;
 	renderer->wlr_renderer.features.output_color_transform = false;
 
 	wl_list_init(&renderer->buffers);
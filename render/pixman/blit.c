@@ -0,0 +1,220 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "render/pixman.h"
+
+/*
+ * Kernels for unscaled rotated and flipped blits of 32-bit formats. pixman
+ * handles these through its generic transformed fetchers, which are several
+ * times slower than a plain copy.
+ *
+ * Every destination row maps to a straight line of source pixels, walked with
+ * a constant step: ±1 for upright and flipped transforms, ±stride for rotated
+ * ones. The destination is processed in square blocks so that the source
+ * lines touched by a rotated blit stay in the cache between rows. Row loops
+ * are specialized for the unit steps so that the compiler can vectorize them.
+ */
+
+#define BLOCK_SIZE 64
+
+enum blit_kind {
+	BLIT_COPY,
+	BLIT_COPY_OPAQUE,
+	BLIT_OVER,
+};
+
+#define RB_MASK 0x00FF00FF
+#define RB_ONE_HALF 0x00800080
+#define RB_MASK_PLUS_ONE 0x10000100
+
+// Same rounding as pixman's UN8x4_MUL_UN8_ADD_UN8x4(), to get identical
+// results as the generic path
+static inline uint32_t mul_un8_rb(uint32_t x, uint32_t a) {
+	uint32_t t = (x & RB_MASK) * a + RB_ONE_HALF;
+	t = (t + ((t >> 8) & RB_MASK)) >> 8;
+	return t & RB_MASK;
+}
+
+static inline uint32_t add_un8_rb(uint32_t x, uint32_t y) {
+	uint32_t t = x + y;
+	t |= RB_MASK_PLUS_ONE - ((t >> 8) & RB_MASK);
+	return t & RB_MASK;
+}
+
+static inline uint32_t over_pixel(uint32_t src, uint32_t dst) {
+	uint32_t ia = 0xFF - (src >> 24);
+	uint32_t rb = add_un8_rb(mul_un8_rb(dst, ia), src & RB_MASK);
+	uint32_t ag = add_un8_rb(mul_un8_rb(dst >> 8, ia), (src >> 8) & RB_MASK);
+	return rb | (ag << 8);
+}
+
+static inline void blit_row(uint32_t *restrict dst, const uint32_t *restrict src,
+		ptrdiff_t step, int n, enum blit_kind kind) {
+	switch (kind) {
+	case BLIT_COPY:
+		for (int i = 0; i < n; i++) {
+			dst[i] = src[i * step];
+		}
+		break;
+	case BLIT_COPY_OPAQUE:
+		for (int i = 0; i < n; i++) {
+			dst[i] = src[i * step] | 0xFF000000;
+		}
+		break;
+	case BLIT_OVER:
+		for (int i = 0; i < n; i++) {
+			dst[i] = over_pixel(src[i * step], dst[i]);
+		}
+		break;
+	}
+}
+
+static void blit_row_dispatch(uint32_t *dst, const uint32_t *src,
+		ptrdiff_t step, int n, enum blit_kind kind) {
+	if (step == 1) {
+		blit_row(dst, src, 1, n, kind);
+	} else if (step == -1) {
+		blit_row(dst, src, -1, n, kind);
+	} else {
+		blit_row(dst, src, step, n, kind);
+	}
+}
+
+static bool get_blit_kind(pixman_op_t op, pixman_format_code_t src_fmt,
+		pixman_format_code_t dst_fmt, enum blit_kind *kind) {
+	if (op != PIXMAN_OP_SRC && op != PIXMAN_OP_OVER) {
+		return false;
+	}
+
+	// Source and destination must share the same channel order. The
+	// padding byte of x formats is undefined, so it may be written freely.
+	bool src_alpha;
+	switch (src_fmt) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_a8b8g8r8:
+		src_alpha = true;
+		break;
+	case PIXMAN_x8r8g8b8:
+	case PIXMAN_x8b8g8r8:
+		src_alpha = false;
+		break;
+	default:
+		return false;
+	}
+
+	bool argb = src_fmt == PIXMAN_a8r8g8b8 || src_fmt == PIXMAN_x8r8g8b8;
+	if (argb && dst_fmt != PIXMAN_a8r8g8b8 && dst_fmt != PIXMAN_x8r8g8b8) {
+		return false;
+	}
+	if (!argb && dst_fmt != PIXMAN_a8b8g8r8 && dst_fmt != PIXMAN_x8b8g8r8) {
+		return false;
+	}
+
+	if (!src_alpha) {
+		*kind = BLIT_COPY_OPAQUE;
+	} else if (op == PIXMAN_OP_SRC) {
+		*kind = BLIT_COPY;
+	} else {
+		*kind = BLIT_OVER;
+	}
+	return true;
+}
+
+// Extracts an integer coefficient, which must be -1, 0 or 1
+static bool get_unit_coeff(pixman_fixed_t f, int *coeff) {
+	if (f != 0 && f != pixman_fixed_1 && f != -pixman_fixed_1) {
+		return false;
+	}
+	*coeff = f / pixman_fixed_1;
+	return true;
+}
+
+bool pixman_blit_transformed(const struct wlr_pixman_render_op *op,
+		pixman_image_t *src, pixman_image_t *dst, const pixman_region32_t *clip) {
+	if (!op->has_transform || op->has_mask || op->image == NULL) {
+		return false;
+	}
+
+	enum blit_kind kind;
+	if (!get_blit_kind(op->op, pixman_image_get_format(src),
+			pixman_image_get_format(dst), &kind)) {
+		return false;
+	}
+
+	// Only accept a rotation/flip with an integer translation: each
+	// destination pixel center then maps exactly to a source pixel center,
+	// so both nearest and bilinear filtering pick a single source pixel
+	const pixman_fixed_t (*m)[3] = op->transform.matrix;
+	int a, b, c, d;
+	if (!get_unit_coeff(m[0][0], &a) || !get_unit_coeff(m[0][1], &b) ||
+			!get_unit_coeff(m[1][0], &c) || !get_unit_coeff(m[1][1], &d) ||
+			(a != 0) == (b != 0) || (c != 0) == (d != 0) || (a != 0) == (c != 0) ||
+			m[2][0] != 0 || m[2][1] != 0 || m[2][2] != pixman_fixed_1 ||
+			m[0][2] % pixman_fixed_1 != 0 || m[1][2] % pixman_fixed_1 != 0) {
+		return false;
+	}
+
+	// Source pixel sampled for the destination pixel at the box origin
+	int sx0 = m[0][2] / pixman_fixed_1 + (a + b < 0 ? -1 : 0);
+	int sy0 = m[1][2] / pixman_fixed_1 + (c + d < 0 ? -1 : 0);
+
+	int src_width = pixman_image_get_width(src);
+	int src_height = pixman_image_get_height(src);
+	ptrdiff_t src_stride = pixman_image_get_stride(src) / 4;
+	const uint32_t *src_data = pixman_image_get_data(src);
+	ptrdiff_t dst_stride = pixman_image_get_stride(dst) / 4;
+	uint32_t *dst_data = pixman_image_get_data(dst);
+
+	pixman_region32_t region;
+	pixman_region32_init_rect(&region, op->dst_box.x, op->dst_box.y,
+		op->dst_box.width, op->dst_box.height);
+	if (clip != NULL) {
+		pixman_region32_intersect(&region, &region, clip);
+	}
+	pixman_region32_intersect_rect(&region, &region, 0, 0,
+		pixman_image_get_width(dst), pixman_image_get_height(dst));
+
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&region, &n_rects);
+
+	// Samples outside of the source are transparent, leave these to pixman.
+	// The mapping is affine, so checking opposite corners is enough.
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *r = &rects[i];
+		int corners[2][2] = {
+			{ r->x1 - op->dst_box.x, r->y1 - op->dst_box.y },
+			{ r->x2 - 1 - op->dst_box.x, r->y2 - 1 - op->dst_box.y },
+		};
+		for (size_t j = 0; j < 2; j++) {
+			int u = corners[j][0], v = corners[j][1];
+			int sx = sx0 + a * u + b * v;
+			int sy = sy0 + c * u + d * v;
+			if (sx < 0 || sx >= src_width || sy < 0 || sy >= src_height) {
+				pixman_region32_fini(&region);
+				return false;
+			}
+		}
+	}
+
+	// Source step when moving one pixel right in the destination
+	ptrdiff_t step = a + c * src_stride;
+
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *r = &rects[i];
+		for (int by = r->y1; by < r->y2; by += BLOCK_SIZE) {
+			int by2 = by + BLOCK_SIZE < r->y2 ? by + BLOCK_SIZE : r->y2;
+			for (int bx = r->x1; bx < r->x2; bx += BLOCK_SIZE) {
+				int n = bx + BLOCK_SIZE < r->x2 ? BLOCK_SIZE : r->x2 - bx;
+				for (int y = by; y < by2; y++) {
+					int u = bx - op->dst_box.x, v = y - op->dst_box.y;
+					int sx = sx0 + a * u + b * v;
+					int sy = sy0 + c * u + d * v;
+					blit_row_dispatch(&dst_data[y * dst_stride + bx],
+						&src_data[sy * src_stride + sx], step, n, kind);
+				}
+			}
+		}
+	}
+
+	pixman_region32_fini(&region);
+	return true;
+}
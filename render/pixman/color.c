@@ -0,0 +1,271 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/color.h"
+#include "render/pixman.h"
+
+/*
+ * Output color transforms are applied as a post-pass over the pixels updated
+ * by a render pass.
+ *
+ * Unlike the Vulkan renderer, pixman blends sRGB-encoded values: buffers
+ * already hold the result of the sRGB transform, and 3D LUTs (which expect
+ * linear input) are indexed by decoding each channel first. Since channels
+ * are 8-bit, the decoding and the position in the LUT are precomputed for
+ * every channel value, which leaves a few integer multiply-adds per pixel.
+ */
+
+// LUT entries are scaled so that interpolated values only need a shift
+#define LUT_SCALE (0xFF << 8)
+#define WEIGHT_ONE 256
+
+static const struct wlr_addon_interface color_transform_impl;
+
+static float srgb_to_linear(float x) {
+	// See https://www.w3.org/Graphics/Color/srgb
+	return x > 0.04045f ? powf((x + 0.055f) / 1.055f, 2.4f) : x / 12.92f;
+}
+
+void pixman_color_transform_destroy(struct wlr_pixman_color_transform *transform) {
+	wl_list_remove(&transform->link);
+	wlr_addon_finish(&transform->addon);
+	free(transform->lut_3d);
+	free(transform);
+}
+
+static void color_transform_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_pixman_color_transform *transform =
+		wl_container_of(addon, transform, addon);
+	pixman_color_transform_destroy(transform);
+}
+
+static const struct wlr_addon_interface color_transform_impl = {
+	.name = "wlr_pixman_color_transform",
+	.destroy = color_transform_addon_destroy,
+};
+
+static struct wlr_pixman_color_transform *color_transform_create(
+		struct wlr_pixman_renderer *renderer, struct wlr_color_transform *base) {
+	struct wlr_color_transform_lut3d *lut3d =
+		wlr_color_transform_lut3d_from_base(base);
+	size_t dim = lut3d->dim_len;
+	if (dim < 2) {
+		wlr_log(WLR_ERROR, "3D LUT is too small");
+		return NULL;
+	}
+
+	struct wlr_pixman_color_transform *transform = calloc(1, sizeof(*transform));
+	if (transform == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	size_t len = 3 * dim * dim * dim;
+	transform->lut_3d = malloc(len * sizeof(transform->lut_3d[0]));
+	if (transform->lut_3d == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(transform);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		float v = lut3d->lut_3d[i];
+		v = v < 0 ? 0 : (v > 1 ? 1 : v);
+		transform->lut_3d[i] = roundf(v * LUT_SCALE);
+	}
+
+	transform->dim_len = dim;
+	transform->stride[0] = 3;
+	transform->stride[1] = 3 * dim;
+	transform->stride[2] = 3 * dim * dim;
+
+	for (int v = 0; v < 256; v++) {
+		float pos = srgb_to_linear(v / 255.0f) * (dim - 1);
+		uint32_t index = floorf(pos);
+		uint32_t weight = roundf((pos - index) * WEIGHT_ONE);
+		if (index >= dim - 1) {
+			index = dim - 2;
+			weight = WEIGHT_ONE;
+		}
+		for (size_t ch = 0; ch < 3; ch++) {
+			transform->offset[ch][v] = index * transform->stride[ch];
+		}
+		transform->weight[v] = weight;
+	}
+
+	wlr_addon_init(&transform->addon, &base->addons, renderer, &color_transform_impl);
+	wl_list_insert(&renderer->color_transforms, &transform->link);
+
+	return transform;
+}
+
+struct wlr_pixman_color_transform *pixman_color_transform_get_or_create(
+		struct wlr_pixman_renderer *renderer, struct wlr_color_transform *base) {
+	struct wlr_addon *addon =
+		wlr_addon_find(&base->addons, renderer, &color_transform_impl);
+	if (addon != NULL) {
+		struct wlr_pixman_color_transform *transform =
+			wl_container_of(addon, transform, addon);
+		return transform;
+	}
+	return color_transform_create(renderer, base);
+}
+
+static inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t w) {
+	return (a * (WEIGHT_ONE - w) + b * w + WEIGHT_ONE / 2) / WEIGHT_ONE;
+}
+
+static void lookup_trilinear(const struct wlr_pixman_color_transform *tr,
+		const uint16_t *c000, const uint32_t w[3], uint32_t out[3]) {
+	size_t sr = tr->stride[0], sg = tr->stride[1], sb = tr->stride[2];
+	for (size_t ch = 0; ch < 3; ch++) {
+		const uint16_t *c = c000 + ch;
+		uint32_t c00 = lerp(c[0], c[sr], w[0]);
+		uint32_t c10 = lerp(c[sg], c[sg + sr], w[0]);
+		uint32_t c01 = lerp(c[sb], c[sb + sr], w[0]);
+		uint32_t c11 = lerp(c[sb + sg], c[sb + sg + sr], w[0]);
+		uint32_t c0 = lerp(c00, c10, w[1]);
+		uint32_t c1 = lerp(c01, c11, w[1]);
+		out[ch] = (lerp(c0, c1, w[2]) + 0x80) >> 8;
+	}
+}
+
+static inline void swap_axes(size_t *a, size_t *b) {
+	size_t tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+static void lookup_tetrahedral(const struct wlr_pixman_color_transform *tr,
+		const uint16_t *c000, const uint32_t w[3], uint32_t out[3]) {
+	// Sort the axes by decreasing weight: the sample lies in the
+	// tetrahedron walking from c000 to c111 along these axes in order
+	size_t a = 0, b = 1, c = 2;
+	if (w[a] < w[b]) {
+		swap_axes(&a, &b);
+	}
+	if (w[b] < w[c]) {
+		swap_axes(&b, &c);
+	}
+	if (w[a] < w[b]) {
+		swap_axes(&a, &b);
+	}
+
+	const uint16_t *c1 = c000 + tr->stride[a];
+	const uint16_t *c2 = c1 + tr->stride[b];
+	const uint16_t *c3 = c2 + tr->stride[c];
+	uint32_t w0 = WEIGHT_ONE - w[a], w1 = w[a] - w[b], w2 = w[b] - w[c], w3 = w[c];
+
+	for (size_t ch = 0; ch < 3; ch++) {
+		uint32_t acc = w0 * c000[ch] + w1 * c1[ch] + w2 * c2[ch] + w3 * c3[ch];
+		out[ch] = (acc + (1 << 15)) >> 16;
+	}
+}
+
+static inline uint32_t unpremultiply(uint32_t c, uint32_t a) {
+	uint32_t v = (c * 0xFF + a / 2) / a;
+	return v > 0xFF ? 0xFF : v;
+}
+
+static inline uint32_t premultiply(uint32_t c, uint32_t a) {
+	uint32_t t = c * a + 0x80;
+	return (t + (t >> 8)) >> 8;
+}
+
+static uint32_t transform_pixel(const struct wlr_pixman_color_transform *tr,
+		enum wlr_pixman_lut3d_interpolation interpolation,
+		uint32_t pixel, int r_shift, int b_shift, bool has_alpha) {
+	uint32_t a = has_alpha ? pixel >> 24 : 0xFF;
+	if (a == 0) {
+		return pixel;
+	}
+
+	uint32_t rgb[3] = {
+		(pixel >> r_shift) & 0xFF,
+		(pixel >> 8) & 0xFF,
+		(pixel >> b_shift) & 0xFF,
+	};
+	if (a != 0xFF) {
+		for (size_t ch = 0; ch < 3; ch++) {
+			rgb[ch] = unpremultiply(rgb[ch], a);
+		}
+	}
+
+	const uint16_t *c000 = tr->lut_3d + tr->offset[0][rgb[0]] +
+		tr->offset[1][rgb[1]] + tr->offset[2][rgb[2]];
+	uint32_t w[3] = { tr->weight[rgb[0]], tr->weight[rgb[1]], tr->weight[rgb[2]] };
+
+	uint32_t out[3];
+	switch (interpolation) {
+	case PIXMAN_LUT3D_TETRAHEDRAL:
+		lookup_tetrahedral(tr, c000, w, out);
+		break;
+	case PIXMAN_LUT3D_TRILINEAR:
+		lookup_trilinear(tr, c000, w, out);
+		break;
+	}
+
+	if (a != 0xFF) {
+		for (size_t ch = 0; ch < 3; ch++) {
+			out[ch] = premultiply(out[ch], a);
+		}
+	}
+
+	return (pixel & 0xFF000000) | out[0] << r_shift | out[1] << 8 | out[2] << b_shift;
+}
+
+bool pixman_color_transform_supports_format(pixman_format_code_t format) {
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+	case PIXMAN_a8b8g8r8:
+	case PIXMAN_x8b8g8r8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void pixman_color_transform_apply(const struct wlr_pixman_color_transform *tr,
+		enum wlr_pixman_lut3d_interpolation interpolation,
+		pixman_image_t *image, const pixman_region32_t *region) {
+	pixman_format_code_t format = pixman_image_get_format(image);
+	assert(pixman_color_transform_supports_format(format));
+
+	bool argb = format == PIXMAN_a8r8g8b8 || format == PIXMAN_x8r8g8b8;
+	int r_shift = argb ? 16 : 0, b_shift = argb ? 0 : 16;
+	bool has_alpha = format == PIXMAN_a8r8g8b8 || format == PIXMAN_a8b8g8r8;
+
+	uint32_t *data = pixman_image_get_data(image);
+	ptrdiff_t stride = pixman_image_get_stride(image) / 4;
+
+	pixman_region32_t clipped;
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, region, 0, 0,
+		pixman_image_get_width(image), pixman_image_get_height(image));
+
+	// Large areas of the same color are common, remember the last result
+	uint32_t last_in = 0;
+	uint32_t last_out = transform_pixel(tr, interpolation, last_in,
+		r_shift, b_shift, has_alpha);
+
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&clipped, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *r = &rects[i];
+		for (int y = r->y1; y < r->y2; y++) {
+			uint32_t *row = &data[y * stride];
+			for (int x = r->x1; x < r->x2; x++) {
+				if (row[x] != last_in) {
+					last_in = row[x];
+					last_out = transform_pixel(tr, interpolation, last_in,
+						r_shift, b_shift, has_alpha);
+				}
+				row[x] = last_out;
+			}
+		}
+	}
+
+	pixman_region32_fini(&clipped);
+}
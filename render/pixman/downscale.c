@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+/*
+ * Cache of box-filtered downscaled copies of textures, similar to mipmaps.
+ *
+ * Levels are only created for textures which are drawn minified more than
+ * once, since building them costs a full read of the texture. The memory used
+ * by all textures of a renderer is capped: least recently used textures lose
+ * their levels first.
+ */
+
+void pixman_texture_init_downscaled(struct wlr_pixman_texture *texture) {
+	pixman_region32_init(&texture->downscale.damage);
+	wl_list_init(&texture->downscale.link);
+}
+
+static void release_levels(struct wlr_pixman_texture *texture) {
+	for (size_t i = 0; i < texture->downscale.n_levels; i++) {
+		pixman_image_unref(texture->downscale.levels[i]);
+		texture->downscale.levels[i] = NULL;
+	}
+	texture->downscale.n_levels = 0;
+
+	texture->renderer->downscale_size -= texture->downscale.size;
+	texture->downscale.size = 0;
+
+	pixman_region32_clear(&texture->downscale.damage);
+	wl_list_remove(&texture->downscale.link);
+	wl_list_init(&texture->downscale.link);
+}
+
+void pixman_texture_finish_downscaled(struct wlr_pixman_texture *texture) {
+	release_levels(texture);
+	pixman_region32_fini(&texture->downscale.damage);
+}
+
+void pixman_texture_damage_downscaled(struct wlr_pixman_texture *texture,
+		const pixman_region32_t *damage) {
+	if (texture->downscale.n_levels == 0) {
+		return;
+	}
+	pixman_region32_union(&texture->downscale.damage,
+		&texture->downscale.damage, damage);
+}
+
+static bool is_format_supported(pixman_format_code_t format) {
+	// Each channel is averaged on its own, the channel order doesn't matter
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+	case PIXMAN_a8b8g8r8:
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_b8g8r8a8:
+	case PIXMAN_b8g8r8x8:
+	case PIXMAN_r8g8b8a8:
+	case PIXMAN_r8g8b8x8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static inline uint32_t average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+	uint32_t rb = (a & 0x00FF00FF) + (b & 0x00FF00FF) +
+		(c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+	uint32_t ag = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) +
+		((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002;
+	return ((rb >> 2) & 0x00FF00FF) | (((ag >> 2) & 0x00FF00FF) << 8);
+}
+
+// Fill a box of dst with the 2x2 averages of src
+static void downscale_box(pixman_image_t *dst, pixman_image_t *src,
+		const pixman_box32_t *box) {
+	const uint32_t *src_data = pixman_image_get_data(src);
+	ptrdiff_t src_stride = pixman_image_get_stride(src) / 4;
+	int src_width = pixman_image_get_width(src);
+	int src_height = pixman_image_get_height(src);
+	uint32_t *dst_data = pixman_image_get_data(dst);
+	ptrdiff_t dst_stride = pixman_image_get_stride(dst) / 4;
+
+	for (int y = box->y1; y < box->y2; y++) {
+		// Odd sizes repeat the last row and column
+		int sy = 2 * y;
+		int sy1 = sy + 1 < src_height ? sy + 1 : sy;
+		const uint32_t *row0 = &src_data[sy * src_stride];
+		const uint32_t *row1 = &src_data[sy1 * src_stride];
+		uint32_t *out = &dst_data[y * dst_stride];
+		for (int x = box->x1; x < box->x2; x++) {
+			int sx = 2 * x;
+			int sx1 = sx + 1 < src_width ? sx + 1 : sx;
+			out[x] = average4(row0[sx], row0[sx1], row1[sx], row1[sx1]);
+		}
+	}
+}
+
+static void evict(struct wlr_pixman_renderer *renderer, size_t size,
+		struct wlr_pixman_texture *keep) {
+	struct wlr_pixman_texture *texture, *tmp;
+	wl_list_for_each_reverse_safe(texture, tmp, &renderer->downscale_lru,
+			downscale.link) {
+		if (renderer->downscale_size + size <= renderer->max_downscale_size) {
+			break;
+		}
+		if (texture != keep) {
+			release_levels(texture);
+		}
+	}
+}
+
+static bool add_level(struct wlr_pixman_texture *texture) {
+	struct wlr_pixman_renderer *renderer = texture->renderer;
+	size_t n = texture->downscale.n_levels;
+	pixman_image_t *parent = n > 0 ?
+		texture->downscale.levels[n - 1] : texture->image;
+
+	int width = (pixman_image_get_width(parent) + 1) / 2;
+	int height = (pixman_image_get_height(parent) + 1) / 2;
+	size_t size = (size_t)width * height * 4;
+	if (texture->downscale.size + size > renderer->max_downscale_size) {
+		return false;
+	}
+	evict(renderer, size, texture);
+	if (renderer->downscale_size + size > renderer->max_downscale_size) {
+		return false;
+	}
+
+	pixman_image_t *image = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(parent), width, height, NULL, 0);
+	if (image == NULL) {
+		wlr_log(WLR_ERROR, "Failed to allocate downscaled texture");
+		return false;
+	}
+
+	downscale_box(image, parent, &(pixman_box32_t){
+		.x2 = width,
+		.y2 = height,
+	});
+
+	texture->downscale.levels[n] = image;
+	texture->downscale.n_levels++;
+	texture->downscale.size += size;
+	renderer->downscale_size += size;
+	return true;
+}
+
+// Re-filter the damaged parts of existing levels, from largest to smallest
+static void update_levels(struct wlr_pixman_texture *texture) {
+	pixman_box32_t *extents = pixman_region32_extents(&texture->downscale.damage);
+	if (extents->x1 >= extents->x2 || extents->y1 >= extents->y2) {
+		return;
+	}
+
+	int n_rects;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&texture->downscale.damage, &n_rects);
+	for (size_t i = 0; i < texture->downscale.n_levels; i++) {
+		pixman_image_t *level = texture->downscale.levels[i];
+		pixman_image_t *parent = i > 0 ?
+			texture->downscale.levels[i - 1] : texture->image;
+		int shift = i + 1;
+		int width = pixman_image_get_width(level);
+		int height = pixman_image_get_height(level);
+
+		for (int j = 0; j < n_rects; j++) {
+			int round = (1 << shift) - 1;
+			pixman_box32_t box = {
+				.x1 = rects[j].x1 >> shift,
+				.y1 = rects[j].y1 >> shift,
+				.x2 = (rects[j].x2 + round) >> shift,
+				.y2 = (rects[j].y2 + round) >> shift,
+			};
+			box.x2 = box.x2 < width ? box.x2 : width;
+			box.y2 = box.y2 < height ? box.y2 : height;
+			downscale_box(level, parent, &box);
+		}
+	}
+
+	pixman_region32_clear(&texture->downscale.damage);
+}
+
+pixman_image_t *pixman_texture_get_downscaled(struct wlr_pixman_texture *texture,
+		int *level_ptr) {
+	int level = *level_ptr;
+	assert(level > 0 && level <= PIXMAN_DOWNSCALE_MAX_LEVELS);
+	struct wlr_pixman_renderer *renderer = texture->renderer;
+
+	if (renderer->max_downscale_size == 0 ||
+			!is_format_supported(pixman_image_get_format(texture->image))) {
+		return NULL;
+	}
+
+	// Textures drawn minified only once, e.g. during an animation, aren't
+	// worth the extra read
+	if ((size_t)level > texture->downscale.n_levels &&
+			texture->downscale.minified_draws < 1) {
+		texture->downscale.minified_draws++;
+		return NULL;
+	}
+
+	wl_list_remove(&texture->downscale.link);
+	wl_list_insert(&renderer->downscale_lru, &texture->downscale.link);
+
+	update_levels(texture);
+
+	while (texture->downscale.n_levels < (size_t)level) {
+		if (!add_level(texture)) {
+			break;
+		}
+	}
+
+	if (texture->downscale.n_levels == 0) {
+		return NULL;
+	}
+	// If the cache is full, use the closest level available
+	if ((size_t)level > texture->downscale.n_levels) {
+		level = texture->downscale.n_levels;
+	}
+	*level_ptr = level;
+	return texture->downscale.levels[level - 1];
+}
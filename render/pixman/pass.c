@@ -1,7 +1,15 @@
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <time.h>
+#include <wlr/util/log.h>
 #include "render/pixman.h"
 
+// Bands smaller than this aren't worth handing over to another thread
+#define MIN_BAND_HEIGHT 16
+// Number of bands per thread, to balance uneven workloads
+#define BANDS_PER_THREAD 4
+
 static const struct wlr_render_pass_impl render_pass_impl;
 
 static struct wlr_pixman_render_pass *get_render_pass(struct wlr_render_pass *wlr_pass) {
@@ -16,16 +24,301 @@ static struct wlr_pixman_texture *get_texture(struct wlr_texture *wlr_texture) {
 	return texture;
 }
 
+static void composite_op(const struct wlr_pixman_render_op *op,
+		pixman_image_t *src, pixman_image_t *dst, const pixman_region32_t *clip) {
+	if (op->blit_kernels && pixman_blit_transformed(op, src, dst, clip)) {
+		return;
+	}
+
+	pixman_image_t *mask = NULL;
+	if (op->has_mask) {
+		mask = pixman_image_create_solid_fill(&(struct pixman_color){
+			.alpha = op->mask_alpha,
+		});
+	}
+
+	if (op->image != NULL) {
+		if (op->has_transform) {
+			pixman_image_set_transform(src, &op->transform);
+			pixman_image_set_filter(src, op->filter, NULL, 0);
+		} else {
+			pixman_image_set_transform(src, NULL);
+		}
+	}
+
+	pixman_image_set_clip_region32(dst, clip);
+	pixman_image_composite32(op->op, src, mask, dst,
+		op->src_x, op->src_y, 0, 0, op->dst_box.x, op->dst_box.y,
+		op->dst_box.width, op->dst_box.height);
+	pixman_image_set_clip_region32(dst, NULL);
+
+	if (op->has_transform) {
+		pixman_image_set_transform(src, NULL);
+	}
+
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
+}
+
+static pixman_image_t *create_image_view(pixman_image_t *image) {
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+		pixman_image_get_width(image), pixman_image_get_height(image),
+		pixman_image_get_data(image), pixman_image_get_stride(image));
+}
+
+struct render_replay {
+	const struct wlr_pixman_render_pass *pass;
+	const pixman_region32_t *updated; // NULL without a color transform
+	int32_t y1, y2, band_height, n_bands;
+	atomic_int next_band;
+};
+
+static void replay_bands(void *data) {
+	struct render_replay *replay = data;
+	const struct wlr_pixman_render_pass *pass = replay->pass;
+
+	// Images are not thread-safe: each thread uses its own views of the
+	// destination and source pixels, so that clips and transforms don't
+	// clash. Since every pixel belongs to exactly one band and operations
+	// are replayed in order, the result is the same as a serial execution.
+	pixman_image_t *dst = create_image_view(pass->buffer->image);
+	if (dst == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image");
+		return;
+	}
+	int32_t width = pixman_image_get_width(dst);
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+
+	while (true) {
+		int band = atomic_fetch_add(&replay->next_band, 1);
+		if (band >= replay->n_bands) {
+			break;
+		}
+
+		int32_t y = replay->y1 + band * replay->band_height;
+		int32_t height = replay->band_height;
+		if (y + height > replay->y2) {
+			height = replay->y2 - y;
+		}
+
+		const struct wlr_pixman_render_op *op;
+		wl_array_for_each(op, &pass->ops) {
+			const pixman_box32_t *extents = pixman_region32_extents(&op->clip);
+			if (extents->y2 <= y || extents->y1 >= y + height) {
+				continue;
+			}
+
+			pixman_region32_intersect_rect(&clip, &op->clip, 0, y, width, height);
+			if (!pixman_region32_not_empty(&clip)) {
+				continue;
+			}
+
+			pixman_image_t *src;
+			if (op->image != NULL) {
+				src = create_image_view(op->image);
+			} else {
+				src = pixman_image_create_solid_fill(&op->color);
+			}
+			if (src == NULL) {
+				wlr_log(WLR_ERROR, "Failed to create pixman image");
+				continue;
+			}
+
+			composite_op(op, src, dst, &clip);
+			pixman_image_unref(src);
+		}
+
+		// The band is complete, apply the color transform while it's hot
+		if (replay->updated != NULL) {
+			pixman_region32_intersect_rect(&clip, replay->updated,
+				0, y, width, height);
+			pixman_color_transform_apply(pass->color_transform,
+				pass->buffer->renderer->lut3d_interpolation, dst, &clip);
+		}
+	}
+
+	pixman_region32_fini(&clip);
+	pixman_image_unref(dst);
+}
+
+static void replay_ops(struct wlr_pixman_render_pass *pass,
+		const pixman_region32_t *updated) {
+	struct wlr_pixman_workers *workers = pass->buffer->renderer->workers;
+
+	int32_t y1 = INT32_MAX, y2 = INT32_MIN;
+	const struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		const pixman_box32_t *extents = pixman_region32_extents(&op->clip);
+		if (extents->y1 < y1) {
+			y1 = extents->y1;
+		}
+		if (extents->y2 > y2) {
+			y2 = extents->y2;
+		}
+	}
+
+	int32_t height = pass->buffer->buffer->height;
+	y1 = y1 < 0 ? 0 : y1;
+	y2 = y2 > height ? height : y2;
+	if (y1 >= y2) {
+		return;
+	}
+
+	int32_t n_bands = (workers->n_threads + 1) * BANDS_PER_THREAD;
+	int32_t band_height = (y2 - y1 + n_bands - 1) / n_bands;
+	if (band_height < MIN_BAND_HEIGHT) {
+		band_height = MIN_BAND_HEIGHT;
+	}
+
+	struct render_replay replay = {
+		.pass = pass,
+		.updated = updated,
+		.y1 = y1,
+		.y2 = y2,
+		.band_height = band_height,
+		.n_bands = (y2 - y1 + band_height - 1) / band_height,
+	};
+	atomic_init(&replay.next_band, 0);
+
+	if (replay.n_bands == 1) {
+		replay_bands(&replay);
+	} else {
+		pixman_workers_run(workers, replay_bands, &replay);
+	}
+}
+
 static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 
+	const pixman_region32_t *updated = NULL;
+	if (pass->color_transform != NULL) {
+		updated = rect_union_evaluate(&pass->updated);
+	}
+
+	if (pass->ops.size > 0) {
+		replay_ops(pass, updated);
+	} else if (updated != NULL) {
+		pixman_color_transform_apply(pass->color_transform,
+			pass->buffer->renderer->lut3d_interpolation,
+			pass->buffer->image, updated);
+	}
+
+	if (pass->color_transform != NULL) {
+		rect_union_finish(&pass->updated);
+	}
+
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		pixman_region32_fini(&op->clip);
+		if (op->image != NULL) {
+			pixman_image_unref(op->image);
+		}
+	}
+	wl_array_release(&pass->ops);
+
+	struct wlr_buffer **buffer_ptr;
+	wl_array_for_each(buffer_ptr, &pass->accessed_buffers) {
+		wlr_buffer_end_data_ptr_access(*buffer_ptr);
+		wlr_buffer_unlock(*buffer_ptr);
+	}
+	wl_array_release(&pass->accessed_buffers);
+
 	wlr_buffer_end_data_ptr_access(pass->buffer->buffer);
 	wlr_buffer_unlock(pass->buffer->buffer);
+
+	if (pass->timer != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &pass->timer->end);
+		pass->timer->complete = true;
+	}
+
 	free(pass);
 
 	return true;
 }
 
+// Remembers the pixels which need to go through the color transform
+static void mark_updated(struct wlr_pixman_render_pass *pass,
+		const struct wlr_box *box, const pixman_region32_t *clip) {
+	if (pass->color_transform == NULL) {
+		return;
+	}
+
+	pixman_box32_t dst = {
+		.x1 = box->x,
+		.y1 = box->y,
+		.x2 = box->x + box->width,
+		.y2 = box->y + box->height,
+	};
+	if (clip == NULL) {
+		rect_union_add(&pass->updated, dst);
+		return;
+	}
+
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(clip, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		pixman_box32_t rect = {
+			.x1 = rects[i].x1 > dst.x1 ? rects[i].x1 : dst.x1,
+			.y1 = rects[i].y1 > dst.y1 ? rects[i].y1 : dst.y1,
+			.x2 = rects[i].x2 < dst.x2 ? rects[i].x2 : dst.x2,
+			.y2 = rects[i].y2 < dst.y2 ? rects[i].y2 : dst.y2,
+		};
+		rect_union_add(&pass->updated, rect);
+	}
+}
+
+static void record_op(struct wlr_pixman_render_pass *pass,
+		const struct wlr_pixman_render_op *op, const pixman_region32_t *clip) {
+	struct wlr_pixman_render_op *recorded = wl_array_add(&pass->ops, sizeof(*op));
+	if (recorded == NULL) {
+		wlr_log(WLR_ERROR, "Failed to record pixman render operation");
+		if (op->image != NULL) {
+			pixman_image_unref(op->image);
+		}
+		return;
+	}
+
+	*recorded = *op;
+	pixman_region32_init_rect(&recorded->clip, op->dst_box.x, op->dst_box.y,
+		op->dst_box.width, op->dst_box.height);
+	if (clip != NULL) {
+		pixman_region32_intersect(&recorded->clip, &recorded->clip, clip);
+	}
+}
+
+// Keeps the texture's pixels readable until the pass is submitted
+static bool access_texture(struct wlr_pixman_render_pass *pass,
+		struct wlr_pixman_texture *texture) {
+	if (texture->buffer == NULL) {
+		return true;
+	}
+
+	struct wlr_buffer **buffer_ptr;
+	wl_array_for_each(buffer_ptr, &pass->accessed_buffers) {
+		if (*buffer_ptr == texture->buffer) {
+			return true;
+		}
+	}
+
+	if (!begin_pixman_data_ptr_access(texture->buffer,
+			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+		return false;
+	}
+
+	buffer_ptr = wl_array_add(&pass->accessed_buffers, sizeof(*buffer_ptr));
+	if (buffer_ptr == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		wlr_buffer_end_data_ptr_access(texture->buffer);
+		return false;
+	}
+	*buffer_ptr = wlr_buffer_lock(texture->buffer);
+
+	return true;
+}
+
 static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	switch (mode) {
 	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
@@ -36,22 +329,78 @@ static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	abort();
 }
 
+/**
+ * When the texture is drawn much smaller than its size, switch to a
+ * box-filtered downscaled copy: bilinear filtering only looks at 4 source
+ * pixels, so it aliases badly and is slow past a factor of 2. The source box
+ * is adjusted to the coordinates of the returned image.
+ */
+static pixman_image_t *get_downscaled_image(struct wlr_pixman_texture *texture,
+		struct wlr_fbox *src_fbox, enum wl_output_transform transform,
+		const struct wlr_box *dst_box) {
+	if (dst_box->width <= 0 || dst_box->height <= 0) {
+		return texture->image;
+	}
+
+	double width = src_fbox->width, height = src_fbox->height;
+	if (transform & WL_OUTPUT_TRANSFORM_90) {
+		width = src_fbox->height;
+		height = src_fbox->width;
+	}
+
+	// Pick the smallest level which is still larger than the destination
+	int level = 0;
+	while (level < PIXMAN_DOWNSCALE_MAX_LEVELS &&
+			width >= 2 * dst_box->width && height >= 2 * dst_box->height) {
+		width /= 2;
+		height /= 2;
+		level++;
+	}
+	if (level == 0) {
+		return texture->image;
+	}
+
+	pixman_image_t *image = pixman_texture_get_downscaled(texture, &level);
+	if (image == NULL) {
+		return texture->image;
+	}
+
+	double scale = 1.0 / (1 << level);
+	src_fbox->x *= scale;
+	src_fbox->y *= scale;
+	src_fbox->width *= scale;
+	src_fbox->height *= scale;
+	return image;
+}
+
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_texture_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_pixman_texture *texture = get_texture(options->texture);
 	struct wlr_pixman_buffer *buffer = pass->buffer;
+	bool threaded = buffer->renderer->workers != NULL;
 
-	if (texture->buffer != NULL && !begin_pixman_data_ptr_access(texture->buffer,
-			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+	if (threaded) {
+		if (!access_texture(pass, texture)) {
+			return;
+		}
+	} else if (texture->buffer != NULL && !begin_pixman_data_ptr_access(
+			texture->buffer, &texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
 		return;
 	}
 
-	pixman_op_t op = get_pixman_blending(options->blend_mode);
-	pixman_image_set_clip_region32(buffer->image, options->clip);
-
 	struct wlr_fbox src_fbox;
 	wlr_render_texture_options_get_src_box(options, &src_fbox);
+
+	struct wlr_box dst_box;
+	wlr_render_texture_options_get_dst_box(options, &dst_box);
+
+	pixman_image_t *image = texture->image;
+	if (options->filter_mode == WLR_SCALE_FILTER_BILINEAR) {
+		image = get_downscaled_image(texture, &src_fbox, options->transform,
+			&dst_box);
+	}
+
 	struct wlr_box src_box = {
 		.x = roundf(src_fbox.x),
 		.y = roundf(src_fbox.y),
@@ -59,16 +408,12 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		.height = roundf(src_fbox.height),
 	};
 
-	struct wlr_box dst_box;
-	wlr_render_texture_options_get_dst_box(options, &dst_box);
-
-	pixman_image_t *mask = NULL;
 	float alpha = wlr_render_texture_options_get_alpha(options);
-	if (alpha != 1) {
-		mask = pixman_image_create_solid_fill(&(struct pixman_color){
-			.alpha = 0xFFFF * alpha,
-		});
-	}
+	struct wlr_pixman_render_op op = {
+		.op = get_pixman_blending(options->blend_mode),
+		.has_mask = alpha != 1,
+		.mask_alpha = 0xFFFF * alpha,
+	};
 
 	// Rotate the source size into destination coordinates
 	struct wlr_box src_box_transformed;
@@ -118,51 +463,49 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		// coordinates.  But this only applies to internal wlroots code - the viewporter
 		// extension code makes sure that to clients everything works as it should.
 
-		struct pixman_transform transform;
-		pixman_transform_init_identity(&transform);
+		struct pixman_transform *transform = &op.transform;
+		pixman_transform_init_identity(transform);
 
 		// Apply scaling to get to the dst_box size.  Because the scaling is applied last
 		// it depends on the whether the rotation swapped width and height, which is why
 		// we use src_box_transformed instead of src_box.
-		pixman_transform_scale(&transform, NULL,
+		pixman_transform_scale(transform, NULL,
 			pixman_double_to_fixed(src_box_transformed.width / (double)dst_box.width),
 			pixman_double_to_fixed(src_box_transformed.height / (double)dst_box.height));
 
 		// pixman rotates about the origin which again leaves everything outside of the
 		// viewport.  Translate the result so that its new top-left corner is back at the
 		// origin.
-		pixman_transform_translate(&transform, NULL,
+		pixman_transform_translate(transform, NULL,
 			-pixman_int_to_fixed(tr_x), -pixman_int_to_fixed(tr_y));
 
 		// Apply the rotation
-		pixman_transform_rotate(&transform, NULL,
+		pixman_transform_rotate(transform, NULL,
 			pixman_int_to_fixed(tr_cos), pixman_int_to_fixed(tr_sin));
 
 		// Apply flip before rotation
 		if (options->transform >= WL_OUTPUT_TRANSFORM_FLIPPED) {
 			// The flip leaves everything left of the Y axis which is outside the
 			// viewport. So translate everything back into the viewport.
-			pixman_transform_translate(&transform, NULL,
+			pixman_transform_translate(transform, NULL,
 				-pixman_int_to_fixed(src_box.width), pixman_int_to_fixed(0));
 			// Flip by applying a scale of -1 to the X axis
-			pixman_transform_scale(&transform, NULL,
+			pixman_transform_scale(transform, NULL,
 				pixman_int_to_fixed(-1), pixman_int_to_fixed(1));
 		}
 
 		// Apply the translation for source crop so the origin is now at the top-left of
 		// the region we're actually using.  Do this last so all the other transforms
 		// apply on top of this.
-		pixman_transform_translate(&transform, NULL,
+		pixman_transform_translate(transform, NULL,
 			pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
 
-		pixman_image_set_transform(texture->image, &transform);
-
 		switch (options->filter_mode) {
 		case WLR_SCALE_FILTER_BILINEAR:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+			op.filter = PIXMAN_FILTER_BILINEAR;
 			break;
 		case WLR_SCALE_FILTER_NEAREST:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+			op.filter = PIXMAN_FILTER_NEAREST;
 			break;
 		}
 
@@ -171,30 +514,34 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		// width,height part of source crop is done here by the width and height we pass:
 		// because of the scaling, cropping at the end by dst_box.{width,height} is
 		// equivalent to if we cropped at the start by src_box.{width,height}.
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			0, 0, // source x,y
-			0, 0, // mask x,y
-			dst_box.x, dst_box.y, // dest x,y
-			dst_box.width, dst_box.height // composite width,height
-		);
-
-		pixman_image_set_transform(texture->image, NULL);
+		op.has_transform = true;
+		op.blit_kernels = buffer->renderer->blit_kernels;
+		op.dst_box = dst_box;
 	} else {
 		// No transforms or crop needed, just a straight blit from the source
-		pixman_image_set_transform(texture->image, NULL);
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			src_box.x, src_box.y, 0, 0, dst_box.x, dst_box.y,
-			src_box.width, src_box.height);
+		op.src_x = src_box.x;
+		op.src_y = src_box.y;
+		op.dst_box = (struct wlr_box){
+			.x = dst_box.x,
+			.y = dst_box.y,
+			.width = src_box.width,
+			.height = src_box.height,
+		};
 	}
 
-	pixman_image_set_clip_region32(buffer->image, NULL);
+	mark_updated(pass, &op.dst_box, options->clip);
 
-	if (texture->buffer != NULL) {
-		wlr_buffer_end_data_ptr_access(texture->buffer);
+	if (threaded) {
+		op.image = pixman_image_ref(image);
+		record_op(pass, &op, options->clip);
+		return;
 	}
 
-	if (mask != NULL) {
-		pixman_image_unref(mask);
+	op.image = image;
+	composite_op(&op, image, buffer->image, options->clip);
+
+	if (texture->buffer != NULL) {
+		wlr_buffer_end_data_ptr_access(texture->buffer);
 	}
 }
 
@@ -202,26 +549,27 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_pixman_buffer *buffer = pass->buffer;
-	struct wlr_box box;
-	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
-
-	pixman_op_t op = get_pixman_blending(options->color.a == 1 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
 
-	struct pixman_color color = {
-		.red = options->color.r * 0xFFFF,
-		.green = options->color.g * 0xFFFF,
-		.blue = options->color.b * 0xFFFF,
-		.alpha = options->color.a * 0xFFFF,
+	struct wlr_pixman_render_op op = {
+		.op = get_pixman_blending(options->color.a == 1 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode),
+		.color = {
+			.red = options->color.r * 0xFFFF,
+			.green = options->color.g * 0xFFFF,
+			.blue = options->color.b * 0xFFFF,
+			.alpha = options->color.a * 0xFFFF,
+		},
 	};
+	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &op.dst_box);
+	mark_updated(pass, &op.dst_box, options->clip);
 
-	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
-
-	pixman_image_set_clip_region32(buffer->image, options->clip);
-	pixman_image_composite32(op, fill, NULL, buffer->image,
-		0, 0, 0, 0, box.x, box.y, box.width, box.height);
-	pixman_image_set_clip_region32(buffer->image, NULL);
+	if (buffer->renderer->workers != NULL) {
+		record_op(pass, &op, options->clip);
+		return;
+	}
 
+	pixman_image_t *fill = pixman_image_create_solid_fill(&op.color);
+	composite_op(&op, fill, buffer->image, options->clip);
 	pixman_image_unref(fill);
 }
 
@@ -232,7 +580,14 @@ static const struct wlr_render_pass_impl render_pass_impl = {
 };
 
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-		struct wlr_pixman_buffer *buffer) {
+		struct wlr_pixman_buffer *buffer,
+		struct wlr_pixman_color_transform *color_transform,
+		struct wlr_pixman_render_timer *timer) {
+	if (timer != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &timer->start);
+		timer->complete = false;
+	}
+
 	struct wlr_pixman_render_pass *pass = calloc(1, sizeof(*pass));
 	if (pass == NULL) {
 		return NULL;
@@ -248,6 +603,14 @@ struct wlr_pixman_render_pass *begin_pixman_render_pass(
 
 	wlr_buffer_lock(buffer->buffer);
 	pass->buffer = buffer;
+	pass->timer = timer;
+	wl_array_init(&pass->ops);
+	wl_array_init(&pass->accessed_buffers);
+
+	pass->color_transform = color_transform;
+	if (color_transform != NULL) {
+		rect_union_init(&pass->updated);
+	}
 
 	return pass;
 }
@@ -1,16 +1,21 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <pixman.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <wayland-util.h>
 #include <wlr/render/interface.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
+#include "render/color.h"
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/env.h"
+#include "util/time.h"
 
 static const struct wlr_renderer_impl renderer_impl;
+static const struct wlr_render_timer_impl render_timer_impl;
 
 bool wlr_renderer_is_pixman(struct wlr_renderer *wlr_renderer) {
 	return wlr_renderer->impl == &renderer_impl;
@@ -83,6 +88,7 @@ static struct wlr_pixman_texture *get_texture(
 static void texture_destroy(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	wl_list_remove(&texture->link);
+	pixman_texture_finish_downscaled(texture);
 	pixman_image_unref(texture->image);
 	wlr_buffer_unlock(texture->buffer);
 	free(texture->data);
@@ -122,7 +128,22 @@ static uint32_t pixman_texture_preferred_read_format(struct wlr_texture *wlr_tex
 	return get_drm_format_from_pixman(pixman_format);
 }
 
+static bool texture_update_from_buffer(struct wlr_texture *wlr_texture,
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+
+	// Textures read the buffer memory directly, so only updates of the same
+	// buffer can be handled
+	if (buffer != texture->buffer) {
+		return false;
+	}
+
+	pixman_texture_damage_downscaled(texture, damage);
+	return true;
+}
+
 static const struct wlr_texture_impl texture_impl = {
+	.update_from_buffer = texture_update_from_buffer,
 	.read_pixels = texture_read_pixels,
 	.preferred_read_format = pixman_texture_preferred_read_format,
 	.destroy = texture_destroy,
@@ -220,6 +241,7 @@ static struct wlr_pixman_texture *pixman_texture_create(
 
 	wlr_texture_init(&texture->wlr_texture, &renderer->wlr_renderer,
 		&texture_impl, width, height);
+	texture->renderer = renderer;
 
 	texture->format_info = drm_get_pixel_format_info(drm_format);
 	if (!texture->format_info) {
@@ -237,6 +259,7 @@ static struct wlr_pixman_texture *pixman_texture_create(
 	}
 
 	wl_list_insert(&renderer->textures, &texture->link);
+	pixman_texture_init_downscaled(texture);
 
 	return texture;
 }
@@ -265,6 +288,7 @@ static struct wlr_texture *pixman_texture_from_buffer(
 	if (!texture->image) {
 		wlr_log(WLR_ERROR, "Failed to create pixman image");
 		wl_list_remove(&texture->link);
+		pixman_texture_finish_downscaled(texture);
 		free(texture);
 		return NULL;
 	}
@@ -287,7 +311,14 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_texture_destroy(&tex->wlr_texture);
 	}
 
+	struct wlr_pixman_color_transform *color_transform, *color_transform_tmp;
+	wl_list_for_each_safe(color_transform, color_transform_tmp,
+			&renderer->color_transforms, link) {
+		pixman_color_transform_destroy(color_transform);
+	}
+
 	wlr_drm_format_set_finish(&renderer->drm_formats);
+	pixman_workers_destroy(renderer->workers);
 
 	free(renderer);
 }
@@ -304,19 +335,85 @@ static struct wlr_render_pass *pixman_begin_buffer_pass(struct wlr_renderer *wlr
 		return NULL;
 	}
 
-	struct wlr_pixman_render_pass *pass = begin_pixman_render_pass(buffer);
+	// Buffers are rendered with sRGB-encoded values already, so only 3D LUTs
+	// need extra work
+	struct wlr_pixman_color_transform *color_transform = NULL;
+	if (options != NULL && options->color_transform != NULL &&
+			options->color_transform->type == COLOR_TRANSFORM_LUT_3D) {
+		if (pixman_color_transform_supports_format(
+				pixman_image_get_format(buffer->image))) {
+			color_transform = pixman_color_transform_get_or_create(renderer,
+				options->color_transform);
+			if (color_transform == NULL) {
+				wlr_log(WLR_ERROR, "Failed to create color transform");
+				return NULL;
+			}
+		} else if (!renderer->color_transform_format_warned) {
+			// Failing would leave the output without any frame, render
+			// without the LUT instead
+			wlr_log(WLR_ERROR, "3D LUT color transforms are unsupported "
+				"with this buffer format, ignoring");
+			renderer->color_transform_format_warned = true;
+		}
+	}
+
+	struct wlr_pixman_render_timer *timer = NULL;
+	if (options != NULL && options->timer != NULL) {
+		timer = pixman_get_render_timer(options->timer);
+	}
+
+	struct wlr_pixman_render_pass *pass =
+		begin_pixman_render_pass(buffer, color_transform, timer);
 	if (pass == NULL) {
 		return NULL;
 	}
 	return &pass->base;
 }
 
+struct wlr_pixman_render_timer *pixman_get_render_timer(
+		struct wlr_render_timer *wlr_timer) {
+	assert(wlr_timer->impl == &render_timer_impl);
+	struct wlr_pixman_render_timer *timer = wl_container_of(wlr_timer, timer, base);
+	return timer;
+}
+
+static struct wlr_render_timer *pixman_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_render_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	timer->base.impl = &render_timer_impl;
+	return &timer->base;
+}
+
+static int pixman_get_render_time(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = pixman_get_render_timer(wlr_timer);
+	if (!timer->complete) {
+		wlr_log(WLR_ERROR, "timer was read before the render pass was submitted");
+		return -1;
+	}
+	return timespec_to_nsec(&timer->end) - timespec_to_nsec(&timer->start);
+}
+
+static void pixman_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = pixman_get_render_timer(wlr_timer);
+	free(timer);
+}
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = pixman_get_render_time,
+	.destroy = pixman_render_timer_destroy,
+};
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.get_texture_formats = pixman_get_texture_formats,
 	.get_render_formats = pixman_get_render_formats,
 	.texture_from_buffer = pixman_texture_from_buffer,
 	.destroy = pixman_destroy,
 	.begin_buffer_pass = pixman_begin_buffer_pass,
+	.render_timer_create = pixman_render_timer_create,
 };
 
 struct wlr_renderer *wlr_pixman_renderer_create(void) {
@@ -327,9 +424,13 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 
 	wlr_log(WLR_INFO, "Creating pixman renderer");
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl, WLR_BUFFER_CAP_DATA_PTR);
-	renderer->wlr_renderer.features.output_color_transform = false;
+	// Pixels are expensive, setting up a composite operation is not
+	renderer->wlr_renderer.damage_rect_cost = 32 * 32;
+	renderer->wlr_renderer.features.output_color_transform = true;
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->color_transforms);
+	wl_list_init(&renderer->downscale_lru);
 
 	size_t len = 0;
 	const uint32_t *formats = get_pixman_drm_formats(&len);
@@ -341,6 +442,27 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 			DRM_FORMAT_MOD_LINEAR);
 	}
 
+	renderer->max_downscale_size = (size_t)env_parse_long(
+		"WLR_PIXMAN_DOWNSCALE_CACHE_SIZE", 0, 4096, 64) * 1024 * 1024;
+	renderer->blit_kernels = !env_parse_bool("WLR_PIXMAN_DISABLE_BLIT_KERNELS");
+
+	static const char *interpolations[] = { "tetrahedral", "trilinear", NULL };
+	switch (env_parse_switch("WLR_PIXMAN_LUT3D_INTERPOLATION", interpolations)) {
+	case 0:
+		renderer->lut3d_interpolation = PIXMAN_LUT3D_TETRAHEDRAL;
+		break;
+	case 1:
+		renderer->lut3d_interpolation = PIXMAN_LUT3D_TRILINEAR;
+		break;
+	}
+
+	// The calling thread takes part in the work, so a single thread means
+	// no workers at all
+	long threads = env_parse_long("WLR_PIXMAN_THREADS", 0, 256, 1);
+	if (threads > 1) {
+		renderer->workers = pixman_workers_create(threads - 1);
+	}
+
 	return &renderer->wlr_renderer;
 }
 
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+static void *worker_main(void *data) {
+	struct wlr_pixman_workers *workers = data;
+
+	uint64_t generation = 0;
+	pthread_mutex_lock(&workers->mutex);
+	while (true) {
+		while (!workers->stop && workers->generation == generation) {
+			pthread_cond_wait(&workers->work_cond, &workers->mutex);
+		}
+		if (workers->stop) {
+			break;
+		}
+		generation = workers->generation;
+
+		wlr_pixman_worker_func_t func = workers->func;
+		void *func_data = workers->data;
+		pthread_mutex_unlock(&workers->mutex);
+
+		func(func_data);
+
+		pthread_mutex_lock(&workers->mutex);
+		assert(workers->busy > 0);
+		workers->busy--;
+		if (workers->busy == 0) {
+			pthread_cond_signal(&workers->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&workers->mutex);
+
+	return NULL;
+}
+
+static void stop_workers(struct wlr_pixman_workers *workers, size_t n_started) {
+	pthread_mutex_lock(&workers->mutex);
+	workers->stop = true;
+	pthread_cond_broadcast(&workers->work_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (size_t i = 0; i < n_started; i++) {
+		pthread_join(workers->threads[i], NULL);
+	}
+}
+
+struct wlr_pixman_workers *pixman_workers_create(size_t n_threads) {
+	assert(n_threads > 0);
+
+	struct wlr_pixman_workers *workers = calloc(1, sizeof(*workers));
+	if (workers == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	workers->threads = calloc(n_threads, sizeof(*workers->threads));
+	if (workers->threads == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(workers);
+		return NULL;
+	}
+
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->work_cond, NULL);
+	pthread_cond_init(&workers->done_cond, NULL);
+
+	// Workers must not steal signals from the compositor: the event loop
+	// relies on them being blocked for signalfd
+	sigset_t mask, old_mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+	size_t n_started = 0;
+	for (; n_started < n_threads; n_started++) {
+		int ret = pthread_create(&workers->threads[n_started], NULL,
+			worker_main, workers);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "Failed to create pixman worker thread");
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (n_started < n_threads) {
+		stop_workers(workers, n_started);
+		pixman_workers_destroy(workers);
+		return NULL;
+	}
+
+	workers->n_threads = n_threads;
+	wlr_log(WLR_INFO, "Created %zu pixman worker threads", n_threads);
+
+	return workers;
+}
+
+void pixman_workers_destroy(struct wlr_pixman_workers *workers) {
+	if (workers == NULL) {
+		return;
+	}
+
+	stop_workers(workers, workers->n_threads);
+
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->work_cond);
+	pthread_mutex_destroy(&workers->mutex);
+	free(workers->threads);
+	free(workers);
+}
+
+void pixman_workers_run(struct wlr_pixman_workers *workers,
+		wlr_pixman_worker_func_t func, void *data) {
+	pthread_mutex_lock(&workers->mutex);
+	assert(workers->busy == 0);
+	workers->func = func;
+	workers->data = data;
+	workers->busy = workers->n_threads;
+	workers->generation++;
+	pthread_cond_broadcast(&workers->work_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	func(data);
+
+	pthread_mutex_lock(&workers->mutex);
+	while (workers->busy > 0) {
+		pthread_cond_wait(&workers->done_cond, &workers->mutex);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+}
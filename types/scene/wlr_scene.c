@@ -1,7 +1,9 @@
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wlr/backend.h>
+#include <wlr/render/allocator.h>
 #include <wlr/render/swapchain.h>
 #include <wlr/render/drm_syncobj.h>
 #include <wlr/render/wlr_renderer.h>
@@ -9,8 +11,10 @@
 #include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
 #include <wlr/util/transform.h>
@@ -74,6 +78,8 @@ static void scene_node_init(struct wlr_scene_node *node,
 
 	wl_signal_init(&node->events.destroy);
 	pixman_region32_init(&node->visible);
+	pixman_region32_init(&node->opaque);
+	node->opaque_dirty = true;
 
 	if (parent != NULL) {
 		wl_list_insert(parent->children.prev, &node->link);
@@ -88,11 +94,207 @@ struct highlight_region {
 	struct wl_list link;
 };
 
+/*
+ * Output sets are bitsets indexed by wlr_scene_output.index. The first 64
+ * outputs live in a single word so that the common case doesn't need any
+ * allocation, the remaining ones are stored in an array of uint64_t words.
+ */
+static bool output_set_contains(uint64_t head, const struct wl_array *ext,
+		size_t index) {
+	if (index < 64) {
+		return head & (1ull << index);
+	}
+
+	index -= 64;
+	size_t word = index / 64;
+	if (word >= ext->size / sizeof(uint64_t)) {
+		return false;
+	}
+
+	const uint64_t *words = ext->data;
+	return words[word] & (1ull << (index % 64));
+}
+
+static bool output_set_add(uint64_t *head, struct wl_array *ext, size_t index) {
+	if (index < 64) {
+		*head |= 1ull << index;
+		return true;
+	}
+
+	index -= 64;
+	size_t word = index / 64;
+	while (word >= ext->size / sizeof(uint64_t)) {
+		uint64_t *new_word = wl_array_add(ext, sizeof(*new_word));
+		if (new_word == NULL) {
+			return false;
+		}
+		*new_word = 0;
+	}
+
+	uint64_t *words = ext->data;
+	words[word] |= 1ull << (index % 64);
+	return true;
+}
+
+static bool output_set_empty(uint64_t head, const struct wl_array *ext) {
+	if (head != 0) {
+		return false;
+	}
+
+	const uint64_t *word;
+	wl_array_for_each(word, ext) {
+		if (*word != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool output_set_equal(uint64_t head_a, const struct wl_array *ext_a,
+		uint64_t head_b, const struct wl_array *ext_b) {
+	if (head_a != head_b) {
+		return false;
+	}
+
+	size_t len_a = ext_a->size / sizeof(uint64_t);
+	size_t len_b = ext_b->size / sizeof(uint64_t);
+	const uint64_t *words_a = ext_a->data;
+	const uint64_t *words_b = ext_b->data;
+	for (size_t i = 0; i < len_a || i < len_b; i++) {
+		uint64_t a = i < len_a ? words_a[i] : 0;
+		uint64_t b = i < len_b ? words_b[i] : 0;
+		if (a != b) {
+			return false;
+		}
+	}
+	return true;
+}
+
 static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_buffer *buffer);
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_texture *texture);
 
+static void scene_transaction_remove_node(struct wlr_scene *scene,
+		struct wlr_scene_node *node) {
+	struct wlr_scene_node **nodes = scene->transaction_nodes.data;
+	size_t len = scene->transaction_nodes.size / sizeof(*nodes);
+	for (size_t i = 0; i < len; i++) {
+		if (nodes[i] == node) {
+			array_remove_at(&scene->transaction_nodes,
+				i * sizeof(*nodes), sizeof(*nodes));
+			break;
+		}
+	}
+	node->transaction_pending = false;
+}
+
+/**
+ * Offscreen copy of the contents of a cached tree, for a single output.
+ */
+struct scene_tree_cache {
+	struct wlr_scene_tree *tree;
+	struct wlr_scene_output *output;
+	struct wl_list tree_link; // wlr_scene_tree.caches
+	struct wl_list output_link; // wlr_scene_output.tree_caches
+
+	struct wlr_buffer *buffer;
+	struct wlr_texture *texture;
+	float scale;
+	// Extents of the contents, relative to the tree
+	struct wlr_box box;
+
+	// Set when the extents or the whole contents need to be redrawn
+	bool dirty;
+	// Contents which need to be redrawn, relative to the tree
+	pixman_region32_t damage;
+	// Union of the visible regions of the descendants rendered on the
+	// output, filled while constructing the render list
+	pixman_region32_t visible;
+};
+
+static void scene_tree_cache_destroy(struct scene_tree_cache *cache) {
+	wl_list_remove(&cache->tree_link);
+	wl_list_remove(&cache->output_link);
+	wlr_texture_destroy(cache->texture);
+	wlr_buffer_drop(cache->buffer);
+	pixman_region32_fini(&cache->damage);
+	pixman_region32_fini(&cache->visible);
+	free(cache);
+}
+
+static struct scene_tree_cache *scene_tree_cache_get(struct wlr_scene_tree *tree,
+		struct wlr_scene_output *scene_output, bool create) {
+	struct scene_tree_cache *cache;
+	wl_list_for_each(cache, &tree->caches, tree_link) {
+		if (cache->output == scene_output) {
+			return cache;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	cache->tree = tree;
+	cache->output = scene_output;
+	cache->dirty = true;
+	pixman_region32_init(&cache->damage);
+	pixman_region32_init(&cache->visible);
+	wl_list_insert(&tree->caches, &cache->tree_link);
+	wl_list_insert(&scene_output->tree_caches, &cache->output_link);
+	return cache;
+}
+
+/**
+ * Get the outermost cached ancestor of a node, if any.
+ */
+static struct wlr_scene_tree *scene_node_get_cached_tree(struct wlr_scene_node *node) {
+	struct wlr_scene_tree *cached_tree = NULL;
+	for (struct wlr_scene_tree *tree = node->parent; tree != NULL;
+			tree = tree->node.parent) {
+		if (tree->cached) {
+			cached_tree = tree;
+		}
+	}
+	return cached_tree;
+}
+
+/**
+ * Mark the contents of a node as needing to be redrawn in the caches of its
+ * ancestors. The damage is in node-local coordinates, NULL damages the whole
+ * cache contents.
+ */
+static void scene_node_damage_caches(struct wlr_scene_node *node,
+		const pixman_region32_t *damage) {
+	int x = node->x, y = node->y;
+	for (struct wlr_scene_tree *tree = node->parent; tree != NULL;
+			tree = tree->node.parent) {
+		struct scene_tree_cache *cache;
+		wl_list_for_each(cache, &tree->caches, tree_link) {
+			if (damage == NULL) {
+				cache->dirty = true;
+				continue;
+			}
+
+			pixman_region32_t cache_damage;
+			pixman_region32_init(&cache_damage);
+			pixman_region32_copy(&cache_damage, damage);
+			pixman_region32_translate(&cache_damage, x, y);
+			pixman_region32_union(&cache->damage, &cache->damage, &cache_damage);
+			pixman_region32_fini(&cache_damage);
+		}
+
+		x += tree->node.x;
+		y += tree->node.y;
+	}
+}
+
 void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node == NULL) {
 		return;
@@ -110,16 +312,18 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node->type == WLR_SCENE_NODE_BUFFER) {
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 
-		uint64_t active = scene_buffer->active_outputs;
-		if (active) {
+		if (!output_set_empty(scene_buffer->active_outputs,
+				&scene_buffer->active_outputs_ext)) {
 			struct wlr_scene_output *scene_output;
 			wl_list_for_each(scene_output, &scene->outputs, link) {
-				if (active & (1ull << scene_output->index)) {
+				if (output_set_contains(scene_buffer->active_outputs,
+						&scene_buffer->active_outputs_ext, scene_output->index)) {
 					wl_signal_emit_mutable(&scene_buffer->events.output_leave,
 						scene_output);
 				}
 			}
 		}
+		wl_array_release(&scene_buffer->active_outputs_ext);
 
 		scene_buffer_set_buffer(scene_buffer, NULL);
 		scene_buffer_set_texture(scene_buffer, NULL);
@@ -144,10 +348,19 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_set_gamma.link);
+
+			pixman_region32_fini(&scene->transaction_update_region);
+			pixman_region32_fini(&scene->transaction_damage);
+			wl_array_release(&scene->transaction_nodes);
 		} else {
 			assert(node->parent);
 		}
 
+		struct scene_tree_cache *cache, *cache_tmp;
+		wl_list_for_each_safe(cache, cache_tmp, &scene_tree->caches, tree_link) {
+			scene_tree_cache_destroy(cache);
+		}
+
 		struct wlr_scene_node *child, *child_tmp;
 		wl_list_for_each_safe(child, child_tmp,
 				&scene_tree->children, link) {
@@ -157,8 +370,13 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 
 	assert(wl_list_empty(&node->events.destroy.listener_list));
 
+	if (node->transaction_pending) {
+		scene_transaction_remove_node(scene, node);
+	}
+
 	wl_list_remove(&node->link);
 	pixman_region32_fini(&node->visible);
+	pixman_region32_fini(&node->opaque);
 	free(node);
 }
 
@@ -167,6 +385,7 @@ static void scene_tree_init(struct wlr_scene_tree *tree,
 	*tree = (struct wlr_scene_tree){0};
 	scene_node_init(&tree->node, WLR_SCENE_NODE_TREE, parent);
 	wl_list_init(&tree->children);
+	wl_list_init(&tree->caches);
 }
 
 struct wlr_scene *wlr_scene_create(void) {
@@ -193,6 +412,11 @@ struct wlr_scene *wlr_scene_create(void) {
 	scene->direct_scanout = !env_parse_bool("WLR_SCENE_DISABLE_DIRECT_SCANOUT");
 	scene->calculate_visibility = !env_parse_bool("WLR_SCENE_DISABLE_VISIBILITY");
 	scene->highlight_transparent_region = env_parse_bool("WLR_SCENE_HIGHLIGHT_TRANSPARENT_REGION");
+	scene->spatial_index = !env_parse_bool("WLR_SCENE_DISABLE_SPATIAL_INDEX");
+
+	pixman_region32_init(&scene->transaction_update_region);
+	pixman_region32_init(&scene->transaction_damage);
+	wl_array_init(&scene->transaction_nodes);
 
 	return scene;
 }
@@ -209,13 +433,101 @@ struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 	return tree;
 }
 
+static void scene_invalidate_render_lists(struct wlr_scene *scene);
+
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached) {
+	if (tree->cached == cached) {
+		return;
+	}
+
+	tree->cached = cached;
+
+	if (!cached) {
+		struct scene_tree_cache *cache, *cache_tmp;
+		wl_list_for_each_safe(cache, cache_tmp, &tree->caches, tree_link) {
+			scene_tree_cache_destroy(cache);
+		}
+	}
+
+	scene_invalidate_render_lists(scene_node_get_root(&tree->node));
+}
+
 static void scene_node_get_size(struct wlr_scene_node *node, int *lx, int *ly);
 
+/**
+ * Get the bounding box of a node relative to its parent.
+ */
+static void scene_node_get_bounds(struct wlr_scene_node *node,
+		struct wlr_box *box) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		*box = scene_tree->bounds;
+	} else {
+		*box = (struct wlr_box){0};
+		scene_node_get_size(node, &box->width, &box->height);
+	}
+
+	box->x += node->x;
+	box->y += node->y;
+}
+
+static void box_union(struct wlr_box *dest, const struct wlr_box *box) {
+	if (wlr_box_empty(box)) {
+		return;
+	}
+	if (wlr_box_empty(dest)) {
+		*dest = *box;
+		return;
+	}
+
+	int x1 = dest->x < box->x ? dest->x : box->x;
+	int y1 = dest->y < box->y ? dest->y : box->y;
+	int x2 = dest->x + dest->width > box->x + box->width ?
+		dest->x + dest->width : box->x + box->width;
+	int y2 = dest->y + dest->height > box->y + box->height ?
+		dest->y + dest->height : box->y + box->height;
+
+	*dest = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+}
+
+/**
+ * Recompute the bounding box of a tree and of its ancestors. The walk stops
+ * early as soon as an ancestor's bounds are left unchanged.
+ */
+static void scene_tree_update_bounds(struct wlr_scene_tree *tree) {
+	for (; tree != NULL; tree = tree->node.parent) {
+		struct wlr_box bounds = {0};
+
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &tree->children, link) {
+			if (!child->enabled) {
+				continue;
+			}
+
+			struct wlr_box child_bounds;
+			scene_node_get_bounds(child, &child_bounds);
+			box_union(&bounds, &child_bounds);
+		}
+
+		if (wlr_box_equal(&bounds, &tree->bounds)) {
+			break;
+		}
+
+		tree->bounds = bounds;
+	}
+}
+
 typedef bool (*scene_node_box_iterator_func_t)(struct wlr_scene_node *node,
 	int sx, int sy, void *data);
 
 static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
-		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly) {
+		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly,
+		bool spatial_index) {
 	if (!node->enabled) {
 		return false;
 	}
@@ -223,9 +535,20 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:;
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		// Skip the whole sub-tree if none of its descendants can intersect
+		// the box
+		struct wlr_box bounds = scene_tree->bounds;
+		bounds.x += lx;
+		bounds.y += ly;
+		if (spatial_index && !wlr_box_intersection(&bounds, &bounds, box)) {
+			break;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each_reverse(child, &scene_tree->children, link) {
-			if (_scene_nodes_in_box(child, box, iterator, user_data, lx + child->x, ly + child->y)) {
+			if (_scene_nodes_in_box(child, box, iterator, user_data,
+					lx + child->x, ly + child->y, spatial_index)) {
 				return true;
 			}
 		}
@@ -247,10 +570,36 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 
 static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
 		scene_node_box_iterator_func_t iterator, void *user_data) {
+	struct wlr_scene *scene = scene_node_get_root(node);
+
 	int x, y;
 	wlr_scene_node_coords(node, &x, &y);
 
-	return _scene_nodes_in_box(node, box, iterator, user_data, x, y);
+	return _scene_nodes_in_box(node, box, iterator, user_data, x, y,
+		scene->spatial_index);
+}
+
+/**
+ * Check whether a node is drawn as an opaque black rectangle, which the
+ * render list can skip since the background is black.
+ */
+static bool scene_node_is_black_opaque(struct wlr_scene_node *node) {
+	const float *color;
+	if (node->type == WLR_SCENE_NODE_RECT) {
+		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
+		color = scene_rect->color;
+	} else if (node->type == WLR_SCENE_NODE_BUFFER) {
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		if (!scene_buffer->is_single_pixel_buffer || scene_buffer->opacity != 1) {
+			return false;
+		}
+		color = scene_buffer->single_pixel_buffer_color;
+	} else {
+		return false;
+	}
+
+	static const float black[4] = { 0.f, 0.f, 0.f, 1.f };
+	return memcmp(color, black, sizeof(black)) == 0;
 }
 
 static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
@@ -286,6 +635,20 @@ static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
 	pixman_region32_init_rect(opaque, x, y, width, height);
 }
 
+/**
+ * Get the opaque region of a node in node-local coordinates. The region is
+ * cached until the node is updated.
+ */
+static const pixman_region32_t *scene_node_get_opaque_region(
+		struct wlr_scene_node *node) {
+	if (node->opaque_dirty) {
+		pixman_region32_clear(&node->opaque);
+		scene_node_opaque_region(node, 0, 0, &node->opaque);
+		node->opaque_dirty = false;
+	}
+	return &node->opaque;
+}
+
 struct scene_update_data {
 	pixman_region32_t *visible;
 	pixman_region32_t *update_region;
@@ -362,23 +725,75 @@ static void transform_output_box(struct wlr_box *box, const struct render_data *
 	wlr_box_transform(box, box, transform, data->trans_width, data->trans_height);
 }
 
+/**
+ * Applies the damage accumulated by scene_output_damage() to the damage ring
+ * and the pending commit damage. Damage is only collected as a list of boxes
+ * while the scene changes, so that the region union is computed once per frame
+ * instead of once per node change.
+ */
+static void scene_output_flush_damage(struct wlr_scene_output *scene_output) {
+	struct wl_array *boxes = &scene_output->pending_damage;
+	if (boxes->size == 0) {
+		return;
+	}
+
+	pixman_region32_t damage;
+	if (!pixman_region32_init_rects(&damage, boxes->data,
+			boxes->size / sizeof(pixman_box32_t))) {
+		// Fall back to the whole output
+		pixman_region32_fini(&damage);
+		pixman_region32_init_rect(&damage, 0, 0,
+			scene_output->output->width, scene_output->output->height);
+	}
+
+	wlr_damage_ring_add(&scene_output->damage_ring, &damage);
+	pixman_region32_union(&scene_output->pending_commit_damage,
+		&scene_output->pending_commit_damage, &damage);
+	pixman_region32_fini(&damage);
+
+	// Keep the allocation around for the next frame
+	boxes->size = 0;
+}
+
 static void scene_output_damage(struct wlr_scene_output *scene_output,
 		const pixman_region32_t *damage) {
 	struct wlr_output *output = scene_output->output;
 
-	pixman_region32_t clipped;
-	pixman_region32_init(&clipped);
-	pixman_region32_intersect_rect(&clipped, damage, 0, 0, output->width, output->height);
-
-	if (!pixman_region32_empty(&clipped)) {
-		wlr_output_schedule_frame(scene_output->output);
-		wlr_damage_ring_add(&scene_output->damage_ring, &clipped);
+	bool damaged = false;
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		pixman_box32_t box = {
+			.x1 = rects[i].x1 > 0 ? rects[i].x1 : 0,
+			.y1 = rects[i].y1 > 0 ? rects[i].y1 : 0,
+			.x2 = rects[i].x2 < output->width ? rects[i].x2 : output->width,
+			.y2 = rects[i].y2 < output->height ? rects[i].y2 : output->height,
+		};
+		if (box.x1 >= box.x2 || box.y1 >= box.y2) {
+			continue;
+		}
 
-		pixman_region32_union(&scene_output->pending_commit_damage,
-			&scene_output->pending_commit_damage, &clipped);
+		pixman_box32_t *entry =
+			wl_array_add(&scene_output->pending_damage, sizeof(*entry));
+		if (entry == NULL) {
+			// Apply the damage right away instead
+			scene_output_flush_damage(scene_output);
+			pixman_region32_t region;
+			pixman_region32_init_rect(&region, box.x1, box.y1,
+				box.x2 - box.x1, box.y2 - box.y1);
+			wlr_damage_ring_add(&scene_output->damage_ring, &region);
+			pixman_region32_union(&scene_output->pending_commit_damage,
+				&scene_output->pending_commit_damage, &region);
+			pixman_region32_fini(&region);
+		} else {
+			*entry = box;
+		}
+		damaged = true;
 	}
 
-	pixman_region32_fini(&clipped);
+	if (damaged) {
+		wlr_output_schedule_frame(scene_output->output);
+	}
 }
 
 static void scene_output_damage_whole(struct wlr_scene_output *scene_output) {
@@ -424,6 +839,8 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 
 	size_t count = 0;
 	uint64_t active_outputs = 0;
+	struct wl_array active_outputs_ext;
+	wl_array_init(&active_outputs_ext);
 
 	// let's update the outputs in two steps:
 	//  - the primary outputs
@@ -453,14 +870,15 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 		pixman_region32_intersect_rect(&intersection, &node->visible,
 			output_box.x, output_box.y, output_box.width, output_box.height);
 
-		if (!pixman_region32_empty(&intersection)) {
+		if (!pixman_region32_empty(&intersection) &&
+				output_set_add(&active_outputs, &active_outputs_ext,
+					scene_output->index)) {
 			uint32_t overlap = region_area(&intersection);
 			if (overlap >= largest_overlap) {
 				largest_overlap = overlap;
 				scene_buffer->primary_output = scene_output;
 			}
 
-			active_outputs |= 1ull << scene_output->index;
 			count++;
 		}
 
@@ -472,13 +890,17 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 			(struct wlr_linux_dmabuf_feedback_v1_init_options){0};
 	}
 
+	// Swap the new set in, the old one is kept around in the locals
 	uint64_t old_active = scene_buffer->active_outputs;
+	struct wl_array old_active_ext = scene_buffer->active_outputs_ext;
 	scene_buffer->active_outputs = active_outputs;
+	scene_buffer->active_outputs_ext = active_outputs_ext;
 
 	wl_list_for_each(scene_output, outputs, link) {
-		uint64_t mask = 1ull << scene_output->index;
-		bool intersects = active_outputs & mask;
-		bool intersects_before = old_active & mask;
+		bool intersects = output_set_contains(active_outputs,
+			&active_outputs_ext, scene_output->index);
+		bool intersects_before = output_set_contains(old_active,
+			&old_active_ext, scene_output->index);
 
 		if (intersects && !intersects_before) {
 			wl_signal_emit_mutable(&scene_buffer->events.output_enter, scene_output);
@@ -489,16 +911,29 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 
 	// if there are active outputs on this node, we should always have a primary
 	// output
-	assert(!scene_buffer->active_outputs || scene_buffer->primary_output);
+	assert(count == 0 || scene_buffer->primary_output);
 
 	// Skip output update event if nothing was updated
-	if (old_active == active_outputs &&
-			(!force || ((1ull << force->index) & ~active_outputs)) &&
+	bool unchanged = output_set_equal(old_active, &old_active_ext,
+		active_outputs, &active_outputs_ext);
+	wl_array_release(&old_active_ext);
+	if (unchanged &&
+			(!force || !output_set_contains(active_outputs,
+				&active_outputs_ext, force->index)) &&
 			old_primary_output == scene_buffer->primary_output) {
 		return;
 	}
 
-	struct wlr_scene_output *outputs_array[64];
+	struct wlr_scene_output *outputs_stack[64];
+	struct wlr_scene_output **outputs_array = outputs_stack;
+	if (count > sizeof(outputs_stack) / sizeof(outputs_stack[0])) {
+		outputs_array = calloc(count, sizeof(*outputs_array));
+		if (outputs_array == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return;
+		}
+	}
+
 	struct wlr_scene_outputs_update_event event = {
 		.active = outputs_array,
 		.size = count,
@@ -506,7 +941,8 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 
 	size_t i = 0;
 	wl_list_for_each(scene_output, outputs, link) {
-		if (~active_outputs & (1ull << scene_output->index)) {
+		if (!output_set_contains(active_outputs, &active_outputs_ext,
+				scene_output->index)) {
 			continue;
 		}
 
@@ -515,6 +951,10 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 	}
 
 	wl_signal_emit_mutable(&scene_buffer->events.outputs_update, &event);
+
+	if (outputs_array != outputs_stack) {
+		free(outputs_array);
+	}
 }
 
 #if WLR_HAS_XWAYLAND
@@ -587,20 +1027,45 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 	struct wlr_box box = { .x = lx, .y = ly };
 	scene_node_get_size(node, &box.width, &box.height);
 
+	// Nodes which only intersect the bounding box of the update region keep
+	// their visibility. They can't occlude any of the remaining visible
+	// region either, since it's a subset of the update region.
+	pixman_box32_t rect = {
+		.x1 = box.x,
+		.y1 = box.y,
+		.x2 = box.x + box.width,
+		.y2 = box.y + box.height,
+	};
+	if (pixman_region32_contains_rectangle(data->update_region, &rect) ==
+			PIXMAN_REGION_OUT) {
+		goto out;
+	}
+
 	pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
-	pixman_region32_union(&node->visible, &node->visible, data->visible);
-	pixman_region32_intersect_rect(&node->visible, &node->visible,
-		lx, ly, box.width, box.height);
 
-	if (data->calculate_visibility) {
-		pixman_region32_t opaque;
-		pixman_region32_init(&opaque);
-		scene_node_opaque_region(node, lx, ly, &opaque);
-		pixman_region32_subtract(data->visible, data->visible, &opaque);
-		pixman_region32_fini(&opaque);
+	// Once the update region is fully occluded, nodes further down can only
+	// lose visibility
+	if (!pixman_region32_empty(data->visible)) {
+		pixman_region32_union(&node->visible, &node->visible, data->visible);
+		pixman_region32_intersect_rect(&node->visible, &node->visible,
+			lx, ly, box.width, box.height);
+
+		if (data->calculate_visibility) {
+			const pixman_region32_t *opaque = scene_node_get_opaque_region(node);
+			if (!pixman_region32_empty(opaque)) {
+				pixman_region32_translate(data->visible, -lx, -ly);
+				pixman_region32_subtract(data->visible, data->visible, opaque);
+				pixman_region32_translate(data->visible, lx, ly);
+			}
+		}
+	} else {
+		pixman_region32_intersect_rect(&node->visible, &node->visible,
+			lx, ly, box.width, box.height);
 	}
 
 	update_node_update_outputs(node, data->outputs, NULL, NULL);
+
+out:
 #if WLR_HAS_XWAYLAND
 	restack_xwayland_surface(node, &box, data);
 #endif
@@ -646,8 +1111,19 @@ static void scene_node_bounds(struct wlr_scene_node *node,
 	pixman_region32_union_rect(visible, visible, x, y, width, height);
 }
 
+static void scene_invalidate_render_lists(struct wlr_scene *scene) {
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		scene_output->render_list_dirty = true;
+	}
+}
+
 static void scene_update_region(struct wlr_scene *scene,
 		pixman_region32_t *update_region) {
+	// Visibility, position or stacking of nodes may change: the cached
+	// render lists can't be trusted anymore
+	scene_invalidate_render_lists(scene);
+
 	pixman_region32_t visible;
 	pixman_region32_init(&visible);
 	pixman_region32_copy(&visible, update_region);
@@ -672,16 +1148,60 @@ static void scene_update_region(struct wlr_scene *scene,
 	pixman_region32_fini(&visible);
 }
 
+/**
+ * Defer the update of a node to the commit of the pending transaction.
+ *
+ * The node visibility isn't updated until the transaction is committed, so
+ * the damage collected here is what is currently displayed on the outputs.
+ * The new visible region of the node is only known once all of the changes
+ * are applied: remember the node so that it can be damaged on commit.
+ */
+static void scene_transaction_add_update(struct wlr_scene *scene,
+		struct wlr_scene_node *node, const pixman_region32_t *update_region,
+		const pixman_region32_t *damage) {
+	pixman_region32_union(&scene->transaction_update_region,
+		&scene->transaction_update_region, update_region);
+	pixman_region32_union(&scene->transaction_damage,
+		&scene->transaction_damage, damage);
+
+	if (node == NULL || node->transaction_pending) {
+		return;
+	}
+
+	struct wlr_scene_node **node_ptr =
+		wl_array_add(&scene->transaction_nodes, sizeof(*node_ptr));
+	if (node_ptr == NULL) {
+		// Fall back to damaging everything which may have changed
+		pixman_region32_union(&scene->transaction_damage,
+			&scene->transaction_damage, update_region);
+		return;
+	}
+
+	*node_ptr = node;
+	node->transaction_pending = true;
+}
+
 static void scene_node_update(struct wlr_scene_node *node,
 		pixman_region32_t *damage) {
 	struct wlr_scene *scene = scene_node_get_root(node);
 
+	node->opaque_dirty = true;
+	scene_node_damage_caches(node, NULL);
+
+	if (scene->spatial_index) {
+		scene_tree_update_bounds(node->parent);
+	}
+
 	int x, y;
 	if (!wlr_scene_node_coords(node, &x, &y)) {
 #if WLR_HAS_XWAYLAND
 		restack_xwayland_surface_below(node);
 #endif
-		if (damage) {
+		if (damage && scene->transaction_depth > 0) {
+			scene_invalidate_render_lists(scene);
+			scene_transaction_add_update(scene, NULL, damage, damage);
+			pixman_region32_fini(damage);
+		} else if (damage) {
 			scene_update_region(scene, damage);
 			scene_damage_outputs(scene, damage);
 			pixman_region32_fini(damage);
@@ -702,6 +1222,16 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_copy(&update_region, damage);
 	scene_node_bounds(node, x, y, &update_region);
 
+	if (scene->transaction_depth > 0) {
+		// The render lists may reference nodes which are about to be
+		// destroyed, they can't wait for the transaction to be committed
+		scene_invalidate_render_lists(scene);
+		scene_transaction_add_update(scene, node, &update_region, damage);
+		pixman_region32_fini(&update_region);
+		pixman_region32_fini(damage);
+		return;
+	}
+
 	scene_update_region(scene, &update_region);
 	pixman_region32_fini(&update_region);
 
@@ -710,6 +1240,46 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_fini(damage);
 }
 
+void wlr_scene_transaction_begin(struct wlr_scene *scene) {
+	scene->transaction_depth++;
+}
+
+void wlr_scene_transaction_commit(struct wlr_scene *scene) {
+	assert(scene->transaction_depth > 0);
+	scene->transaction_depth--;
+	if (scene->transaction_depth > 0) {
+		return;
+	}
+
+	if (!pixman_region32_empty(&scene->transaction_update_region)) {
+		scene_update_region(scene, &scene->transaction_update_region);
+	}
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &scene->transaction_damage);
+
+	// Now that visibility is up-to-date, damage the new visible region of
+	// the nodes which were changed
+	struct wlr_scene_node **node_ptr;
+	wl_array_for_each(node_ptr, &scene->transaction_nodes) {
+		struct wlr_scene_node *node = *node_ptr;
+		node->transaction_pending = false;
+
+		int x, y;
+		if (wlr_scene_node_coords(node, &x, &y)) {
+			scene_node_visibility(node, &damage);
+		}
+	}
+	scene->transaction_nodes.size = 0;
+
+	scene_damage_outputs(scene, &damage);
+	pixman_region32_fini(&damage);
+
+	pixman_region32_clear(&scene->transaction_update_region);
+	pixman_region32_clear(&scene->transaction_damage);
+}
+
 struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_tree *parent,
 		int width, int height, const float color[static 4]) {
 	assert(parent);
@@ -772,6 +1342,7 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	scene_buffer->own_buffer = false;
 	scene_buffer->buffer_width = scene_buffer->buffer_height = 0;
 	scene_buffer->buffer_is_opaque = false;
+	scene_buffer->is_single_pixel_buffer = false;
 
 	if (!buffer) {
 		return;
@@ -783,6 +1354,28 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	scene_buffer->buffer_height = buffer->height;
 	scene_buffer->buffer_is_opaque = wlr_buffer_is_opaque(buffer);
 
+	// Surface buffers are wrapped into client buffers, look at the source
+	struct wlr_buffer *source = buffer;
+	struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(buffer);
+	if (client_buffer != NULL && client_buffer->source != NULL) {
+		source = client_buffer->source;
+	}
+
+	struct wlr_single_pixel_buffer_v1 *single_pixel_buffer =
+		wlr_single_pixel_buffer_v1_try_from_buffer(source);
+	if (single_pixel_buffer != NULL) {
+		scene_buffer->is_single_pixel_buffer = true;
+		scene_buffer->single_pixel_buffer_color[0] =
+			(double)single_pixel_buffer->r / UINT32_MAX;
+		scene_buffer->single_pixel_buffer_color[1] =
+			(double)single_pixel_buffer->g / UINT32_MAX;
+		scene_buffer->single_pixel_buffer_color[2] =
+			(double)single_pixel_buffer->b / UINT32_MAX;
+		scene_buffer->single_pixel_buffer_color[3] =
+			(double)single_pixel_buffer->a / UINT32_MAX;
+		scene_buffer->buffer_is_opaque = single_pixel_buffer->a == UINT32_MAX;
+	}
+
 	scene_buffer->buffer_release.notify = scene_buffer_handle_buffer_release;
 	wl_signal_add(&buffer->events.release, &scene_buffer->buffer_release);
 }
@@ -874,11 +1467,18 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 			scene_buffer->buffer_height != buffer->height;
 	}
 
+	bool prev_opaque = scene_buffer->buffer_is_opaque;
+	bool prev_black = scene_node_is_black_opaque(&scene_buffer->node);
+
 	scene_buffer_set_buffer(scene_buffer, buffer);
 	scene_buffer_set_texture(scene_buffer, NULL);
 	scene_buffer_set_wait_timeline(scene_buffer,
 		options->wait_timeline, options->wait_point);
 
+	// Opaque and black buffers change the visibility of the nodes below
+	update = update || prev_opaque != scene_buffer->buffer_is_opaque ||
+		prev_black != scene_node_is_black_opaque(&scene_buffer->node);
+
 	if (update) {
 		scene_node_update(&scene_buffer->node, NULL);
 		// updating the node will already damage the whole node for us. Return
@@ -926,6 +1526,16 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 		box.x, box.y, box.width, box.height);
 	pixman_region32_translate(&trans_damage, -box.x, -box.y);
 
+	if (scene_node_get_cached_tree(&scene_buffer->node) != NULL) {
+		pixman_region32_t cache_damage;
+		pixman_region32_init(&cache_damage);
+		wlr_region_scale_xy(&cache_damage, &trans_damage, scale_x, scale_y);
+		// Account for filtering when the buffer is scaled
+		wlr_region_expand(&cache_damage, &cache_damage, 1);
+		scene_node_damage_caches(&scene_buffer->node, &cache_damage);
+		pixman_region32_fini(&cache_damage);
+	}
+
 	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
@@ -996,16 +1606,24 @@ void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
 	}
 
 	pixman_region32_copy(&scene_buffer->opaque_region, region);
+	scene_buffer->node.opaque_dirty = true;
 
 	int x, y;
 	if (!wlr_scene_node_coords(&scene_buffer->node, &x, &y)) {
 		return;
 	}
 
+	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+
 	pixman_region32_t update_region;
 	pixman_region32_init(&update_region);
 	scene_node_bounds(&scene_buffer->node, x, y, &update_region);
-	scene_update_region(scene_node_get_root(&scene_buffer->node), &update_region);
+	if (scene->transaction_depth > 0) {
+		pixman_region32_union(&scene->transaction_update_region,
+			&scene->transaction_update_region, &update_region);
+	} else {
+		scene_update_region(scene, &update_region);
+	}
 	pixman_region32_fini(&update_region);
 }
 
@@ -1218,9 +1836,16 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 		scene_node_visibility(node, &visible);
 	}
 
+	scene_node_damage_caches(node, NULL);
+
+	struct wlr_scene_tree *old_parent = node->parent;
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
+
+	if (scene_node_get_root(node)->spatial_index) {
+		scene_tree_update_bounds(old_parent);
+	}
 	scene_node_update(node, &visible);
 }
 
@@ -1332,85 +1957,409 @@ struct render_list_entry {
 	struct wlr_scene_node *node;
 	bool sent_dmabuf_feedback;
 	bool highlight_transparent_region;
+	// Displayed by an output layer instead of being composited
+	bool layer;
 	int x, y;
+	// Time spent redrawing the tree cache, only set when profiling
+	int64_t cache_duration;
 };
 
-static void scene_entry_render(struct render_list_entry *entry, const struct render_data *data) {
-	struct wlr_scene_node *node = entry->node;
+struct scene_output_layer {
+	struct wlr_output_layer *layer;
+	// Node displayed by the layer in the last frame. Only used to detect
+	// changes, never dereferenced.
+	const struct wlr_scene_node *node;
+};
 
-	pixman_region32_t render_region;
-	pixman_region32_init(&render_region);
-	pixman_region32_copy(&render_region, &node->visible);
-	pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
-	logical_to_buffer_coords(&render_region, data, true);
-	pixman_region32_intersect(&render_region, &render_region, &data->damage);
-	if (pixman_region32_empty(&render_region)) {
-		pixman_region32_fini(&render_region);
+static void scene_node_extents(struct wlr_scene_node *node, int x, int y,
+		struct wlr_box *extents) {
+	if (!node->enabled) {
 		return;
 	}
 
-	int x = entry->x - data->logical.x;
-	int y = entry->y - data->logical.y;
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_extents(child, x + child->x, y + child->y, extents);
+		}
+		return;
+	}
 
-	struct wlr_box dst_box = {
-		.x = x,
-		.y = y,
-	};
-	scene_node_get_size(node, &dst_box.width, &dst_box.height);
-	transform_output_box(&dst_box, data);
+	struct wlr_box box = { .x = x, .y = y };
+	scene_node_get_size(node, &box.width, &box.height);
+	box_union(extents, &box);
+}
 
-	pixman_region32_t opaque;
-	pixman_region32_init(&opaque);
-	scene_node_opaque_region(node, x, y, &opaque);
-	logical_to_buffer_coords(&opaque, data, false);
-	pixman_region32_subtract(&opaque, &render_region, &opaque);
+struct scene_node_draw_options {
+	struct wlr_render_pass *render_pass;
+	struct wlr_renderer *renderer;
+	struct wlr_box dst_box;
+	const pixman_region32_t *clip;
+	// Transform of the render target, composed with the buffer's
+	enum wl_output_transform transform;
+	// Only used for textures, rects are always blended
+	enum wlr_render_blend_mode blend_mode;
+};
+
+/**
+ * Draw a rect or buffer node. Returns false if the buffer has no texture.
+ */
+static bool scene_node_draw(struct wlr_scene_node *node,
+		const struct scene_node_draw_options *options) {
+	assert(node->type != WLR_SCENE_NODE_TREE);
 
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:
-		assert(false);
 		break;
 	case WLR_SCENE_NODE_RECT:;
 		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
 
-		wlr_render_pass_add_rect(data->render_pass, &(struct wlr_render_rect_options){
-			.box = dst_box,
+		wlr_render_pass_add_rect(options->render_pass, &(struct wlr_render_rect_options){
+			.box = options->dst_box,
 			.color = {
 				.r = scene_rect->color[0],
 				.g = scene_rect->color[1],
 				.b = scene_rect->color[2],
 				.a = scene_rect->color[3],
 			},
-			.clip = &render_region,
+			.clip = options->clip,
 		});
-		break;
+		return true;
 	case WLR_SCENE_NODE_BUFFER:;
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 
+		if (scene_buffer->is_single_pixel_buffer) {
+			// The color is pre-multiplied, so is the opacity
+			const float *color = scene_buffer->single_pixel_buffer_color;
+			float opacity = scene_buffer->opacity;
+			wlr_render_pass_add_rect(options->render_pass, &(struct wlr_render_rect_options){
+				.box = options->dst_box,
+				.color = {
+					.r = color[0] * opacity,
+					.g = color[1] * opacity,
+					.b = color[2] * opacity,
+					.a = color[3] * opacity,
+				},
+				.clip = options->clip,
+			});
+			return true;
+		}
+
 		struct wlr_texture *texture = scene_buffer_get_texture(scene_buffer,
-			data->output->output->renderer);
+			options->renderer);
 		if (texture == NULL) {
-			scene_output_damage(data->output, &render_region);
-			break;
+			return false;
 		}
 
 		enum wl_output_transform transform =
 			wlr_output_transform_invert(scene_buffer->transform);
-		transform = wlr_output_transform_compose(transform, data->transform);
+		transform = wlr_output_transform_compose(transform, options->transform);
 
-		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+		wlr_render_pass_add_texture(options->render_pass, &(struct wlr_render_texture_options) {
 			.texture = texture,
 			.src_box = scene_buffer->src_box,
-			.dst_box = dst_box,
+			.dst_box = options->dst_box,
 			.transform = transform,
-			.clip = &render_region,
+			.clip = options->clip,
 			.alpha = &scene_buffer->opacity,
 			.filter_mode = scene_buffer->filter_mode,
-			.blend_mode = !data->output->scene->calculate_visibility ||
-					!pixman_region32_empty(&opaque) ?
-				WLR_RENDER_BLEND_MODE_PREMULTIPLIED : WLR_RENDER_BLEND_MODE_NONE,
+			.blend_mode = options->blend_mode,
 			.wait_timeline = scene_buffer->wait_timeline,
 			.wait_point = scene_buffer->wait_point,
 		});
+		return true;
+	}
+	return false;
+}
+
+struct tree_cache_render_data {
+	struct wlr_render_pass *render_pass;
+	struct wlr_renderer *renderer;
+	const pixman_region32_t *clip;
+	float scale;
+};
+
+static void scene_node_render_to_cache(struct wlr_scene_node *node, int x, int y,
+		const struct tree_cache_render_data *data) {
+	if (!node->enabled) {
+		return;
+	}
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_render_to_cache(child, x + child->x, y + child->y, data);
+		}
+		return;
+	}
+
+	struct wlr_box dst_box = { .x = x, .y = y };
+	scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	scale_box(&dst_box, data->scale);
+
+	scene_node_draw(node, &(struct scene_node_draw_options){
+		.render_pass = data->render_pass,
+		.renderer = data->renderer,
+		.dst_box = dst_box,
+		.clip = data->clip,
+		.transform = WL_OUTPUT_TRANSFORM_NORMAL,
+		.blend_mode = WLR_RENDER_BLEND_MODE_PREMULTIPLIED,
+	});
+}
+
+/**
+ * Redraw the damaged contents of a tree cache. The cache is rendered
+ * untransformed, at the scale of the output.
+ */
+static bool scene_tree_cache_update(struct scene_tree_cache *cache, float scale) {
+	struct wlr_output *output = cache->output->output;
+
+	if (cache->scale != scale) {
+		cache->scale = scale;
+		cache->dirty = true;
+	}
+
+	if (cache->dirty) {
+		struct wlr_box box = {0};
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &cache->tree->children, link) {
+			scene_node_extents(child, child->x, child->y, &box);
+		}
+
+		int width = scale_length(box.width, box.x, scale);
+		int height = scale_length(box.height, box.y, scale);
+		if (cache->buffer == NULL || cache->buffer->width != width ||
+				cache->buffer->height != height) {
+			wlr_texture_destroy(cache->texture);
+			cache->texture = NULL;
+			wlr_buffer_drop(cache->buffer);
+			cache->buffer = NULL;
+
+			if (width <= 0 || height <= 0) {
+				cache->box = box;
+				cache->dirty = false;
+				pixman_region32_clear(&cache->damage);
+				return true;
+			}
+
+			struct wlr_drm_format format = {0};
+			if (!output_pick_format(output, NULL, &format, DRM_FORMAT_ARGB8888)) {
+				wlr_log(WLR_ERROR, "Failed to pick a format for the tree cache");
+				return false;
+			}
+
+			cache->buffer = wlr_allocator_create_buffer(output->allocator,
+				width, height, &format);
+			wlr_drm_format_finish(&format);
+			if (cache->buffer == NULL) {
+				wlr_log(WLR_ERROR, "Failed to allocate the tree cache buffer");
+				return false;
+			}
+		}
+
+		cache->box = box;
+		cache->dirty = false;
+		pixman_region32_fini(&cache->damage);
+		pixman_region32_init_rect(&cache->damage,
+			box.x, box.y, box.width, box.height);
+	}
+
+	if (cache->buffer == NULL ||
+			(cache->texture != NULL && pixman_region32_empty(&cache->damage))) {
+		return true;
+	}
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+	pixman_region32_copy(&clip, &cache->damage);
+	pixman_region32_translate(&clip, -cache->box.x, -cache->box.y);
+	scale_region(&clip, scale, true);
+	pixman_region32_intersect_rect(&clip, &clip, 0, 0,
+		cache->buffer->width, cache->buffer->height);
+
+	struct wlr_render_pass *render_pass =
+		wlr_renderer_begin_buffer_pass(output->renderer, cache->buffer, NULL);
+	if (render_pass == NULL) {
+		pixman_region32_fini(&clip);
+		return false;
+	}
+
+	wlr_render_pass_add_rect(render_pass, &(struct wlr_render_rect_options){
+		.box = { .width = cache->buffer->width, .height = cache->buffer->height },
+		.color = { .r = 0, .g = 0, .b = 0, .a = 0 },
+		.clip = &clip,
+		.blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+	});
+
+	struct tree_cache_render_data render_data = {
+		.render_pass = render_pass,
+		.renderer = output->renderer,
+		.clip = &clip,
+		.scale = scale,
+	};
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &cache->tree->children, link) {
+		scene_node_render_to_cache(child, child->x - cache->box.x,
+			child->y - cache->box.y, &render_data);
+	}
+
+	if (!wlr_render_pass_submit(render_pass)) {
+		pixman_region32_fini(&clip);
+		cache->dirty = true;
+		return false;
+	}
+
+	pixman_region32_clear(&cache->damage);
+
+	// The texture may hold a copy of the buffer (e.g. with shm buffers), in
+	// which case it needs to be updated with the redrawn area
+	if (cache->texture != NULL &&
+			!wlr_texture_update_from_buffer(cache->texture, cache->buffer, &clip)) {
+		wlr_texture_destroy(cache->texture);
+		cache->texture = NULL;
+	}
+	pixman_region32_fini(&clip);
+
+	if (cache->texture == NULL) {
+		cache->texture = wlr_texture_from_buffer(output->renderer, cache->buffer);
+		if (cache->texture == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create the tree cache texture");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void scene_node_send_output_sample(struct wlr_scene_node *node,
+		const pixman_box32_t *output_rect,
+		const struct wlr_scene_output_sample_event *event) {
+	if (!node->enabled) {
+		return;
+	}
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_send_output_sample(child, output_rect, event);
+		}
+	} else if (node->type == WLR_SCENE_NODE_BUFFER &&
+			pixman_region32_contains_rectangle(&node->visible,
+				output_rect) != PIXMAN_REGION_OUT) {
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		wl_signal_emit_mutable(&scene_buffer->events.output_sample,
+			(void *)event);
+	}
+}
+
+static const pixman_region32_t *scene_entry_visible(struct render_list_entry *entry,
+		struct wlr_scene_output *scene_output) {
+	if (entry->node->type == WLR_SCENE_NODE_TREE) {
+		struct scene_tree_cache *cache = scene_tree_cache_get(
+			wlr_scene_tree_from_node(entry->node), scene_output, false);
+		assert(cache != NULL);
+		return &cache->visible;
+	}
+
+	return &entry->node->visible;
+}
+
+static void scene_entry_render(struct render_list_entry *entry, const struct render_data *data) {
+	struct wlr_scene_node *node = entry->node;
+
+	const pixman_region32_t *visible = scene_entry_visible(entry, data->output);
+	struct scene_tree_cache *cache = NULL;
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		cache = scene_tree_cache_get(wlr_scene_tree_from_node(node), data->output, false);
+	}
+
+	pixman_region32_t render_region;
+	pixman_region32_init(&render_region);
+	pixman_region32_copy(&render_region, visible);
+	pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
+	logical_to_buffer_coords(&render_region, data, true);
+	pixman_region32_intersect(&render_region, &render_region, &data->damage);
+	if (pixman_region32_empty(&render_region)) {
+		pixman_region32_fini(&render_region);
+		return;
+	}
+
+	int x = entry->x - data->logical.x;
+	int y = entry->y - data->logical.y;
+
+	struct wlr_box dst_box = {
+		.x = x,
+		.y = y,
+	};
+	scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	if (cache != NULL) {
+		dst_box = cache->box;
+		dst_box.x += x;
+		dst_box.y += y;
+	}
+	transform_output_box(&dst_box, data);
+
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+	pixman_region32_copy(&opaque, scene_node_get_opaque_region(node));
+	pixman_region32_translate(&opaque, x, y);
+	logical_to_buffer_coords(&opaque, data, false);
+	pixman_region32_subtract(&opaque, &render_region, &opaque);
+
+	struct scene_node_draw_options draw_options = {
+		.render_pass = data->render_pass,
+		.renderer = data->output->output->renderer,
+		.dst_box = dst_box,
+		.clip = &render_region,
+		.transform = data->transform,
+		.blend_mode = !data->output->scene->calculate_visibility ||
+				!pixman_region32_empty(&opaque) ?
+			WLR_RENDER_BLEND_MODE_PREMULTIPLIED : WLR_RENDER_BLEND_MODE_NONE,
+	};
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_TREE:;
+		if (cache->texture == NULL) {
+			scene_output_damage(data->output, &render_region);
+			break;
+		}
+
+		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+			.texture = cache->texture,
+			.dst_box = dst_box,
+			.transform = data->transform,
+			.clip = &render_region,
+			.filter_mode = WLR_SCALE_FILTER_BILINEAR,
+			.blend_mode = WLR_RENDER_BLEND_MODE_PREMULTIPLIED,
+		});
+
+		// Only buffers visible on this output sample it, as for nodes in
+		// the render list
+		pixman_box32_t output_rect = {
+			.x1 = data->logical.x,
+			.y1 = data->logical.y,
+			.x2 = data->logical.x + data->logical.width,
+			.y2 = data->logical.y + data->logical.height,
+		};
+		scene_node_send_output_sample(node, &output_rect,
+				&(struct wlr_scene_output_sample_event){
+			.output = data->output,
+			.direct_scanout = false,
+		});
+		break;
+	case WLR_SCENE_NODE_RECT:
+		scene_node_draw(node, &draw_options);
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+
+		if (!scene_node_draw(node, &draw_options)) {
+			scene_output_damage(data->output, &render_region);
+			break;
+		}
 
 		struct wlr_scene_output_sample_event sample_event = {
 			.output = data->output,
@@ -1524,6 +2473,7 @@ static void scene_node_output_update(struct wlr_scene_node *node,
 
 static void scene_output_update_geometry(struct wlr_scene_output *scene_output,
 		bool force_update) {
+	scene_output->render_list_dirty = true;
 	scene_output_damage_whole(scene_output);
 
 	scene_node_output_update(&scene_output->scene->tree.node,
@@ -1540,6 +2490,7 @@ static void scene_output_handle_commit(struct wl_listener *listener, void *data)
 	// will be acknowledged by the backend so we don't need to keep track of it
 	// anymore
 	if (state->committed & WLR_OUTPUT_STATE_BUFFER) {
+		scene_output_flush_damage(scene_output);
 		if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
 			pixman_region32_subtract(&scene_output->pending_commit_damage,
 				&scene_output->pending_commit_damage, &state->damage);
@@ -1609,18 +2560,21 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 
 	wlr_damage_ring_init(&scene_output->damage_ring);
 	pixman_region32_init(&scene_output->pending_commit_damage);
+	wl_array_init(&scene_output->pending_damage);
 	wl_list_init(&scene_output->damage_highlight_regions);
+	wl_list_init(&scene_output->tree_caches);
 
-	int prev_output_index = -1;
+	// Pick the lowest free index, the outputs list is sorted by index
+	size_t output_index = 0;
 	struct wl_list *prev_output_link = &scene->outputs;
 
 	struct wlr_scene_output *current_output;
 	wl_list_for_each(current_output, &scene->outputs, link) {
-		if (prev_output_index + 1 != current_output->index) {
+		if (current_output->index != output_index) {
 			break;
 		}
 
-		prev_output_index = current_output->index;
+		output_index++;
 		prev_output_link = &current_output->link;
 	}
 
@@ -1633,8 +2587,7 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 		}
 	}
 
-	scene_output->index = prev_output_index + 1;
-	assert(scene_output->index < 64);
+	scene_output->index = output_index;
 	wl_list_insert(prev_output_link, &scene_output->link);
 
 	wl_signal_init(&scene_output->events.destroy);
@@ -1676,15 +2629,29 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 		highlight_region_destroy(damage);
 	}
 
+	struct scene_tree_cache *cache, *tmp_cache;
+	wl_list_for_each_safe(cache, tmp_cache, &scene_output->tree_caches, output_link) {
+		scene_tree_cache_destroy(cache);
+	}
+
 	wlr_addon_finish(&scene_output->addon);
 	wlr_damage_ring_finish(&scene_output->damage_ring);
 	pixman_region32_fini(&scene_output->pending_commit_damage);
+	wl_array_release(&scene_output->pending_damage);
 	wl_list_remove(&scene_output->link);
 	wl_list_remove(&scene_output->output_commit.link);
 	wl_list_remove(&scene_output->output_damage.link);
 	wl_list_remove(&scene_output->output_needs_frame.link);
 	wlr_drm_syncobj_timeline_unref(scene_output->in_timeline);
 	wl_array_release(&scene_output->render_list);
+
+	struct scene_output_layer *layers = scene_output->layers.data;
+	size_t layers_len = scene_output->layers.size / sizeof(*layers);
+	for (size_t i = 0; i < layers_len; i++) {
+		wlr_output_layer_destroy(layers[i].layer);
+	}
+	wl_array_release(&scene_output->layers);
+	wl_array_release(&scene_output->layer_states);
 	free(scene_output);
 }
 
@@ -1712,6 +2679,13 @@ void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	scene_output_update_geometry(scene_output, false);
 }
 
+void wlr_scene_output_set_damage_tile_size(struct wlr_scene_output *scene_output,
+		int tile_size) {
+	scene_output_flush_damage(scene_output);
+	wlr_damage_ring_set_tile_size(&scene_output->damage_ring, tile_size);
+	scene_output_damage_whole(scene_output);
+}
+
 static bool scene_node_invisible(struct wlr_scene_node *node) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
 		return true;
@@ -1729,6 +2703,7 @@ static bool scene_node_invisible(struct wlr_scene_node *node) {
 }
 
 struct render_list_constructor_data {
+	struct wlr_scene_output *output;
 	struct wlr_box box;
 	struct wl_array *render_list;
 	bool calculate_visibility;
@@ -1748,14 +2723,10 @@ static bool construct_render_list_iterator(struct wlr_scene_node *node,
 	// black rect, we can ignore rendering everything under the rect, and
 	// unless fractional scale is used even the rect itself (to avoid running
 	// into issues regarding damage region expansion).
-	if (node->type == WLR_SCENE_NODE_RECT && data->calculate_visibility &&
-			(!data->fractional_scale || data->render_list->size == 0)) {
-		struct wlr_scene_rect *rect = wlr_scene_rect_from_node(node);
-		float *black = (float[4]){ 0.f, 0.f, 0.f, 1.f };
-
-		if (memcmp(rect->color, black, sizeof(float) * 4) == 0) {
-			return false;
-		}
+	if (data->calculate_visibility &&
+			(!data->fractional_scale || data->render_list->size == 0) &&
+			scene_node_is_black_opaque(node)) {
+		return false;
 	}
 
 	pixman_region32_t intersection;
@@ -1770,6 +2741,39 @@ static bool construct_render_list_iterator(struct wlr_scene_node *node,
 
 	pixman_region32_fini(&intersection);
 
+	// Descendants of a cached tree are rendered through a single entry for
+	// the tree. They are iterated consecutively, so only the last entry of
+	// the list needs to be checked.
+	struct wlr_scene_tree *cached_tree = scene_node_get_cached_tree(node);
+	struct scene_tree_cache *cache = NULL;
+	if (cached_tree != NULL) {
+		cache = scene_tree_cache_get(cached_tree, data->output, true);
+	}
+	if (cache != NULL) {
+		struct render_list_entry *last = NULL;
+		if (data->render_list->size > 0) {
+			last = (struct render_list_entry *)((char *)data->render_list->data +
+				data->render_list->size) - 1;
+		}
+
+		if (last != NULL && last->node == &cached_tree->node) {
+			pixman_region32_union(&cache->visible, &cache->visible, &node->visible);
+			return false;
+		}
+
+		struct render_list_entry *entry = wl_array_add(data->render_list, sizeof(*entry));
+		if (!entry) {
+			return false;
+		}
+
+		*entry = (struct render_list_entry){
+			.node = &cached_tree->node,
+		};
+		wlr_scene_node_coords(&cached_tree->node, &entry->x, &entry->y);
+		pixman_region32_copy(&cache->visible, &node->visible);
+		return false;
+	}
+
 	struct render_list_entry *entry = wl_array_add(data->render_list, sizeof(*entry));
 	if (!entry) {
 		return false;
@@ -1841,7 +2845,7 @@ static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 	}
 
 	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(node);
-	if (buffer->buffer == NULL) {
+	if (buffer->buffer == NULL || buffer->is_single_pixel_buffer) {
 		return false;
 	}
 
@@ -1913,8 +2917,310 @@ static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 	return true;
 }
 
+static bool scene_entry_layer_eligible(struct render_list_entry *entry,
+		const struct render_data *data) {
+	struct wlr_scene_node *node = entry->node;
+	if (node->type != WLR_SCENE_NODE_BUFFER || entry->highlight_transparent_region) {
+		return false;
+	}
+
+	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(node);
+	if (buffer->buffer == NULL || buffer->is_single_pixel_buffer || buffer->opacity != 1 ||
+			buffer->wait_timeline != NULL || buffer->transform != data->transform) {
+		return false;
+	}
+
+	// Output layers display the whole buffer, so it must be fully visible
+	// and must not extend past the output
+	struct wlr_box box = { .x = entry->x, .y = entry->y };
+	scene_node_get_size(node, &box.width, &box.height);
+
+	struct wlr_box output_box;
+	if (!wlr_box_intersection(&output_box, &box, &data->logical) ||
+			!wlr_box_equal(&output_box, &box)) {
+		return false;
+	}
+
+	pixman_box32_t rect = {
+		.x1 = box.x,
+		.y1 = box.y,
+		.x2 = box.x + box.width,
+		.y2 = box.y + box.height,
+	};
+	return pixman_region32_contains_rectangle(&node->visible, &rect) == PIXMAN_REGION_IN;
+}
+
+static struct wlr_output_layer_state *scene_output_disable_layers(
+		struct wlr_scene_output *scene_output, struct wlr_output_state *state) {
+	struct scene_output_layer *layers = scene_output->layers.data;
+	size_t layers_len = scene_output->layers.size / sizeof(*layers);
+
+	scene_output->layer_states.size = 0;
+	struct wlr_output_layer_state *layer_states = wl_array_add(
+		&scene_output->layer_states, layers_len * sizeof(*layer_states));
+	if (layer_states == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < layers_len; i++) {
+		layer_states[i] = (struct wlr_output_layer_state){
+			.layer = layers[i].layer,
+		};
+	}
+
+	wlr_output_state_set_layers(state, layer_states, layers_len);
+	return layer_states;
+}
+
+static bool scene_output_test_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state) {
+	if (!wlr_output_test_state(scene_output->output, state)) {
+		return false;
+	}
+
+	// Rejected layers are composited, below all other layers. Layers which
+	// were accepted but overlap a rejected layer stacked above them need to
+	// be composited as well.
+	pixman_region32_t composited;
+	pixman_region32_init(&composited);
+
+	bool demoted = false;
+	for (size_t i = state->layers_len; i-- > 0;) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (layer_state->buffer == NULL) {
+			continue;
+		}
+
+		const struct wlr_box *box = &layer_state->dst_box;
+		pixman_box32_t rect = {
+			.x1 = box->x,
+			.y1 = box->y,
+			.x2 = box->x + box->width,
+			.y2 = box->y + box->height,
+		};
+
+		if (layer_state->accepted &&
+				pixman_region32_contains_rectangle(&composited, &rect) == PIXMAN_REGION_OUT) {
+			continue;
+		}
+
+		if (layer_state->accepted) {
+			layer_state->buffer = NULL;
+			demoted = true;
+		}
+		pixman_region32_union_rect(&composited, &composited,
+			box->x, box->y, box->width, box->height);
+	}
+
+	pixman_region32_fini(&composited);
+
+	if (!demoted) {
+		return true;
+	}
+
+	if (!wlr_output_test_state(scene_output->output, state)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < state->layers_len; i++) {
+		if (state->layers[i].buffer != NULL && !state->layers[i].accepted) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Offer the topmost eligible buffers of the render list to the output layers.
+ * The entries accepted by the backend are flagged so that they are skipped
+ * during composition.
+ */
+static void scene_output_update_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, struct render_list_entry *list_data,
+		int list_len, size_t max_layers, const struct render_data *data) {
+	struct wlr_output *output = scene_output->output;
+
+	if (max_layers == 0 && scene_output->layers.size == 0) {
+		return;
+	}
+
+	bool enabled = max_layers > 0 && scene_output->scene->direct_scanout &&
+		!(state->committed & (WLR_OUTPUT_STATE_MODE |
+			WLR_OUTPUT_STATE_ENABLED |
+			WLR_OUTPUT_STATE_RENDER_FORMAT)) &&
+		wlr_output_is_direct_scanout_allowed(output);
+
+	// The composited buffer is displayed below all layers: an entry can only
+	// be lifted onto a layer if no composited entry above overlaps it.
+	size_t candidates_len = 0;
+	if (enabled) {
+		pixman_region32_t composited;
+		pixman_region32_init(&composited);
+
+		for (int i = 0; i < list_len && candidates_len < max_layers; i++) {
+			struct render_list_entry *entry = &list_data[i];
+			if (scene_entry_layer_eligible(entry, data)) {
+				int width, height;
+				scene_node_get_size(entry->node, &width, &height);
+				pixman_box32_t rect = {
+					.x1 = entry->x,
+					.y1 = entry->y,
+					.x2 = entry->x + width,
+					.y2 = entry->y + height,
+				};
+
+				if (pixman_region32_contains_rectangle(&composited,
+						&rect) == PIXMAN_REGION_OUT) {
+					entry->layer = true;
+					candidates_len++;
+					continue;
+				}
+			}
+
+			pixman_region32_union(&composited, &composited,
+				scene_entry_visible(entry, scene_output));
+		}
+
+		pixman_region32_fini(&composited);
+	}
+
+	size_t layers_len = scene_output->layers.size / sizeof(struct scene_output_layer);
+	while (layers_len < candidates_len) {
+		struct wlr_output_layer *layer = wlr_output_layer_create(output);
+		if (layer == NULL) {
+			break;
+		}
+
+		struct scene_output_layer *scene_layer =
+			wl_array_add(&scene_output->layers, sizeof(*scene_layer));
+		if (scene_layer == NULL) {
+			wlr_output_layer_destroy(layer);
+			break;
+		}
+
+		*scene_layer = (struct scene_output_layer){ .layer = layer };
+		layers_len++;
+	}
+
+	struct wlr_output_layer_state *layer_states =
+		scene_output_disable_layers(scene_output, state);
+	if (layer_states == NULL) {
+		layers_len = 0;
+	}
+
+	// Only keep the topmost candidates if we're short on layers, lower
+	// candidates can be composited without breaking the stacking order
+	size_t kept = 0;
+	for (int i = 0; i < list_len; i++) {
+		if (list_data[i].layer) {
+			list_data[i].layer = kept < layers_len;
+			kept++;
+		}
+	}
+	if (candidates_len > layers_len) {
+		candidates_len = layers_len;
+	}
+
+	// Layers are ordered from bottom to top
+	size_t layer_index = 0;
+	for (int i = list_len - 1; i >= 0; i--) {
+		struct render_list_entry *entry = &list_data[i];
+		if (!entry->layer) {
+			continue;
+		}
+
+		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
+		struct wlr_buffer *wlr_buffer = buffer->buffer;
+		struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(wlr_buffer);
+		if (client_buffer != NULL && client_buffer->source != NULL &&
+				client_buffer->source->n_locks > 0) {
+			wlr_buffer = client_buffer->source;
+		}
+
+		struct wlr_output_layer_state *layer_state = &layer_states[layer_index++];
+		layer_state->buffer = wlr_buffer;
+		layer_state->src_box = buffer->src_box;
+		layer_state->dst_box = (struct wlr_box){
+			.x = entry->x - scene_output->x,
+			.y = entry->y - scene_output->y,
+		};
+		scene_node_get_size(entry->node,
+			&layer_state->dst_box.width, &layer_state->dst_box.height);
+		transform_output_box(&layer_state->dst_box, data);
+	}
+
+	if (candidates_len > 0 && !scene_output_test_layers(scene_output, state)) {
+		for (size_t i = 0; i < layers_len; i++) {
+			layer_states[i].buffer = NULL;
+		}
+	}
+
+	struct scene_output_layer *layers = scene_output->layers.data;
+	bool changed = false;
+	size_t offloaded = 0;
+	layer_index = 0;
+	for (int i = list_len - 1; i >= 0; i--) {
+		struct render_list_entry *entry = &list_data[i];
+		if (!entry->layer) {
+			continue;
+		}
+
+		struct scene_output_layer *scene_layer = &layers[layer_index];
+		struct wlr_output_layer_state *layer_state = &layer_states[layer_index];
+		layer_index++;
+
+		entry->layer = layer_state->buffer != NULL && layer_state->accepted;
+		if (!entry->layer) {
+			layer_state->buffer = NULL;
+		}
+
+		const struct wlr_scene_node *node = entry->layer ? entry->node : NULL;
+		changed |= scene_layer->node != node;
+		scene_layer->node = node;
+
+		if (!entry->layer) {
+			continue;
+		}
+
+		offloaded++;
+
+		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
+		if (buffer->primary_output == scene_output) {
+			struct wlr_linux_dmabuf_feedback_v1_init_options options = {
+				.main_renderer = output->renderer,
+				.scanout_primary_output = output,
+			};
+
+			scene_buffer_send_dmabuf_feedback(scene_output->scene, buffer, &options);
+			entry->sent_dmabuf_feedback = true;
+		}
+
+		struct wlr_scene_output_sample_event sample_event = {
+			.output = scene_output,
+			.direct_scanout = true,
+		};
+		wl_signal_emit_mutable(&buffer->events.output_sample, &sample_event);
+	}
+
+	for (; layer_index < layers_len; layer_index++) {
+		changed |= layers[layer_index].node != NULL;
+		layers[layer_index].node = NULL;
+	}
+
+	// The composited buffer doesn't contain the contents of buffers which
+	// were displayed by layers and may contain the ones which now are
+	if (changed) {
+		wlr_log(WLR_DEBUG, "Displaying %zu buffers with output layers", offloaded);
+		scene_output_damage_whole(scene_output);
+		scene_output_flush_damage(scene_output);
+		wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
+	}
+}
+
 bool wlr_scene_output_needs_frame(struct wlr_scene_output *scene_output) {
 	return scene_output->output->needs_frame ||
+		scene_output->pending_damage.size > 0 ||
 		!pixman_region32_empty(&scene_output->pending_commit_damage) ||
 		scene_output->gamma_lut_changed;
 }
@@ -1971,6 +3277,42 @@ static void scene_output_state_attempt_gamma(struct wlr_scene_output *scene_outp
 	wlr_output_state_finish(&gamma_pending);
 }
 
+static void scene_timer_reset(struct wlr_scene_timer *timer) {
+	if (timer->render_timer) {
+		wlr_render_timer_destroy(timer->render_timer);
+		timer->render_timer = NULL;
+	}
+
+	timer->pre_render_duration = 0;
+	timer->render_list_duration = 0;
+	timer->damage_duration = 0;
+	timer->node_costs.size = 0;
+}
+
+static void scene_timer_add_node_cost(struct wlr_scene_timer *timer,
+		struct wlr_scene_node *node, int64_t duration) {
+	struct wlr_scene_timer_node_cost *cost =
+		wl_array_add(&timer->node_costs, sizeof(*cost));
+	if (cost == NULL) {
+		return;
+	}
+
+	struct wl_client *client = NULL;
+	if (node->type == WLR_SCENE_NODE_BUFFER) {
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_try_from_buffer(wlr_scene_buffer_from_node(node));
+		if (scene_surface != NULL) {
+			client = wl_resource_get_client(scene_surface->surface->resource);
+		}
+	}
+
+	*cost = (struct wlr_scene_timer_node_cost){
+		.node = node,
+		.client = client,
+		.duration_ns = duration,
+	};
+}
+
 bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
 	struct wlr_scene_output_state_options default_options = {0};
@@ -1981,9 +3323,10 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	struct timespec start_time;
 	if (timer) {
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		wlr_scene_timer_finish(timer);
-		*timer = (struct wlr_scene_timer){0};
+		scene_timer_reset(timer);
 	}
+	bool profile = timer != NULL && timer->profile_nodes;
+	int64_t profile_start = 0;
 
 	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && !state->enabled) {
 		// if the state is being disabled, do nothing.
@@ -2030,6 +3373,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	render_data.logical.height = render_data.trans_height / render_data.scale;
 
 	struct render_list_constructor_data list_con = {
+		.output = scene_output,
 		.box = render_data.logical,
 		.render_list = &scene_output->render_list,
 		.calculate_visibility = scene_output->scene->calculate_visibility,
@@ -2037,34 +3381,64 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		.fractional_scale = floor(render_data.scale) != render_data.scale,
 	};
 
-	list_con.render_list->size = 0;
-	scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
-		construct_render_list_iterator, &list_con);
-	array_realloc(list_con.render_list, list_con.render_list->size);
+	if (profile) {
+		profile_start = get_current_time_nsec();
+	}
+
+	// The render list only depends on the structure of the scene-graph and
+	// on the output geometry. Frames which only carry buffer damage can
+	// re-use the list built for a previous frame.
+	if (scene_output->render_list_dirty ||
+			!wlr_box_equal(&scene_output->render_list_box, &list_con.box) ||
+			scene_output->render_list_fractional_scale != list_con.fractional_scale) {
+		list_con.render_list->size = 0;
+		scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
+			construct_render_list_iterator, &list_con);
+		array_realloc(list_con.render_list, list_con.render_list->size);
+
+		scene_output->render_list_dirty = false;
+		scene_output->render_list_box = list_con.box;
+		scene_output->render_list_fractional_scale = list_con.fractional_scale;
+	}
 
 	struct render_list_entry *list_data = list_con.render_list->data;
 	int list_len = list_con.render_list->size / sizeof(*list_data);
 
+	if (profile) {
+		timer->render_list_duration = get_current_time_nsec() - profile_start;
+		profile_start = get_current_time_nsec();
+	}
+
+	for (int i = 0; i < list_len; i++) {
+		list_data[i].sent_dmabuf_feedback = false;
+		list_data[i].layer = false;
+	}
+
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
 		scene_output_damage_whole(scene_output);
 	}
 
+	scene_output_flush_damage(scene_output);
+
 	struct timespec now;
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
 		struct wl_list *regions = &scene_output->damage_highlight_regions;
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
 		// add the current frame's damage if there is damage
-		if (!pixman_region32_empty(&scene_output->damage_ring.current)) {
+		pixman_region32_t current;
+		pixman_region32_init(&current);
+		wlr_damage_ring_get_current(&scene_output->damage_ring, &current);
+		if (!pixman_region32_empty(&current)) {
 			struct highlight_region *current_damage = calloc(1, sizeof(*current_damage));
 			if (current_damage) {
 				pixman_region32_init(&current_damage->region);
-				pixman_region32_copy(&current_damage->region,
-					&scene_output->damage_ring.current);
+				pixman_region32_copy(&current_damage->region, &current);
 				current_damage->when = now;
 				wl_list_insert(regions, &current_damage->link);
 			}
 		}
+		pixman_region32_fini(&current);
 
 		pixman_region32_t acc_damage;
 		pixman_region32_init(&acc_damage);
@@ -2085,17 +3459,28 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 		scene_output_damage(scene_output, &acc_damage);
 		pixman_region32_fini(&acc_damage);
+		scene_output_flush_damage(scene_output);
 	}
 
 	wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
 
+	if (profile) {
+		timer->damage_duration = get_current_time_nsec() - profile_start;
+	}
+
 	// We only want to try direct scanout if:
 	// - There is only one entry in the render list
 	// - There are no color transforms that need to be applied
 	// - Damage highlight debugging is not enabled
-	bool scanout = options->color_transform == NULL &&
-		list_len == 1 && debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
-		scene_entry_try_direct_scanout(&list_data[0], state, &render_data);
+	bool scanout = false;
+	if (options->color_transform == NULL && list_len == 1 &&
+			debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		// Output layers need to be disabled along with direct scan-out
+		if (scene_output->layers.size > 0) {
+			scene_output_disable_layers(scene_output, state);
+		}
+		scanout = scene_entry_try_direct_scanout(&list_data[0], state, &render_data);
+	}
 
 	if (scene_output->prev_scanout != scanout) {
 		scene_output->prev_scanout = scanout;
@@ -2104,6 +3489,12 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	}
 
 	if (scanout) {
+		struct scene_output_layer *layers = scene_output->layers.data;
+		size_t layers_len = scene_output->layers.size / sizeof(*layers);
+		for (size_t i = 0; i < layers_len; i++) {
+			layers[i].node = NULL;
+		}
+
 		scene_output_state_attempt_gamma(scene_output, state);
 
 		if (timer) {
@@ -2115,6 +3506,39 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		return true;
 	}
 
+	// Output layers can't apply color transforms and would hide the damage
+	// highlight
+	size_t max_layers = options->max_layers;
+	if (options->color_transform != NULL ||
+			debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		max_layers = 0;
+	}
+	scene_output_update_layers(scene_output, state, list_data, list_len,
+		max_layers, &render_data);
+
+	// Tree caches are redrawn before the output contents, since they are
+	// rendered with a separate pass
+	for (int i = 0; i < list_len; i++) {
+		struct render_list_entry *entry = &list_data[i];
+		if (entry->node->type != WLR_SCENE_NODE_TREE) {
+			continue;
+		}
+
+		if (profile) {
+			profile_start = get_current_time_nsec();
+		}
+
+		struct scene_tree_cache *cache = scene_tree_cache_get(
+			wlr_scene_tree_from_node(entry->node), scene_output, false);
+		if (!scene_tree_cache_update(cache, render_data.scale)) {
+			wlr_log(WLR_ERROR, "Failed to update tree cache");
+		}
+
+		if (profile) {
+			entry->cache_duration = get_current_time_nsec() - profile_start;
+		}
+	}
+
 	struct wlr_swapchain *swapchain = options->swapchain;
 	if (!swapchain) {
 		if (!wlr_output_configure_primary_swapchain(output, state, &output->swapchain)) {
@@ -2155,7 +3579,13 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	render_data.render_pass = render_pass;
 
+	if (profile) {
+		profile_start = get_current_time_nsec();
+	}
+
 	pixman_region32_init(&render_data.damage);
+	scene_output_flush_damage(scene_output);
+	scene_output->damage_ring.rect_cost = output->renderer->damage_rect_cost;
 	wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer,
 		&render_data.damage);
 
@@ -2177,7 +3607,9 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			// rendering in that black rect region, consider the node's visibility.
 			pixman_region32_t opaque;
 			pixman_region32_init(&opaque);
-			scene_node_opaque_region(entry->node, entry->x, entry->y, &opaque);
+			pixman_region32_copy(&opaque,
+				scene_node_get_opaque_region(entry->node));
+			pixman_region32_translate(&opaque, entry->x, entry->y);
 			pixman_region32_intersect(&opaque, &opaque, &entry->node->visible);
 
 			pixman_region32_translate(&opaque, -scene_output->x, -scene_output->y);
@@ -2195,6 +3627,10 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		}
 	}
 
+	if (profile) {
+		timer->damage_duration += get_current_time_nsec() - profile_start;
+	}
+
 	wlr_render_pass_add_rect(render_pass, &(struct wlr_render_rect_options){
 		.box = { .width = buffer->width, .height = buffer->height },
 		.color = { .r = 0, .g = 0, .b = 0, .a = 1 },
@@ -2204,8 +3640,22 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	for (int i = list_len - 1; i >= 0; i--) {
 		struct render_list_entry *entry = &list_data[i];
+		if (entry->layer) {
+			continue;
+		}
+
+		if (profile) {
+			profile_start = get_current_time_nsec();
+		}
+
 		scene_entry_render(entry, &render_data);
 
+		if (profile) {
+			scene_timer_add_node_cost(timer, entry->node, entry->cache_duration +
+				get_current_time_nsec() - profile_start);
+			entry->cache_duration = 0;
+		}
+
 		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
 			struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
 
@@ -2273,6 +3723,17 @@ int64_t wlr_scene_timer_get_duration_ns(struct wlr_scene_timer *timer) {
 void wlr_scene_timer_finish(struct wlr_scene_timer *timer) {
 	if (timer->render_timer) {
 		wlr_render_timer_destroy(timer->render_timer);
+		timer->render_timer = NULL;
+	}
+	wl_array_release(&timer->node_costs);
+	wl_array_init(&timer->node_costs);
+}
+
+void wlr_scene_timer_for_each_node(struct wlr_scene_timer *timer,
+		wlr_scene_timer_node_iterator_func_t iterator, void *user_data) {
+	struct wlr_scene_timer_node_cost *cost;
+	wl_array_for_each(cost, &timer->node_costs) {
+		iterator(cost, user_data);
 	}
 }
 
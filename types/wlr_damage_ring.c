@@ -1,4 +1,7 @@
+#include <assert.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pixman.h>
@@ -7,35 +10,295 @@
 #include <wlr/util/box.h>
 
 #define WLR_DAMAGE_RING_MAX_RECTS 20
+// Upper bound on the number of rectangles considered by the quadratic merge
+#define WLR_DAMAGE_RING_MAX_INPUT_RECTS 64
 
 void wlr_damage_ring_init(struct wlr_damage_ring *ring) {
-	*ring = (struct wlr_damage_ring){ 0 };
+	*ring = (struct wlr_damage_ring){
+		.rect_cost = 64 * 64,
+	};
 	pixman_region32_init(&ring->current);
 	wl_list_init(&ring->buffers);
 }
 
+static size_t tiles_stride(const struct wlr_damage_ring_tiles *tiles) {
+	return (tiles->width + 63) / 64;
+}
+
+static size_t tiles_len(const struct wlr_damage_ring_tiles *tiles) {
+	return tiles_stride(tiles) * tiles->height;
+}
+
+static bool tiles_init(struct wlr_damage_ring_tiles *tiles, int width, int height) {
+	*tiles = (struct wlr_damage_ring_tiles){
+		.width = width,
+		.height = height,
+	};
+	if (tiles_len(tiles) == 0) {
+		return true;
+	}
+	tiles->bits = calloc(tiles_len(tiles), sizeof(*tiles->bits));
+	return tiles->bits != NULL;
+}
+
+static void tiles_finish(struct wlr_damage_ring_tiles *tiles) {
+	free(tiles->bits);
+	*tiles = (struct wlr_damage_ring_tiles){0};
+}
+
+static void tiles_clear(struct wlr_damage_ring_tiles *tiles) {
+	if (tiles->bits != NULL) {
+		memset(tiles->bits, 0, tiles_len(tiles) * sizeof(*tiles->bits));
+	}
+}
+
+/**
+ * Grows the grid to at least width x height tiles, keeping its contents.
+ */
+static bool tiles_reserve(struct wlr_damage_ring_tiles *tiles, int width, int height) {
+	if (width <= tiles->width && height <= tiles->height) {
+		return true;
+	}
+
+	struct wlr_damage_ring_tiles grown;
+	if (!tiles_init(&grown, width > tiles->width ? width : tiles->width,
+			height > tiles->height ? height : tiles->height)) {
+		return false;
+	}
+
+	size_t stride = tiles_stride(tiles), grown_stride = tiles_stride(&grown);
+	for (int y = 0; y < tiles->height; y++) {
+		memcpy(&grown.bits[y * grown_stride], &tiles->bits[y * stride],
+			stride * sizeof(*tiles->bits));
+	}
+
+	tiles_finish(tiles);
+	*tiles = grown;
+	return true;
+}
+
+static void tiles_or(struct wlr_damage_ring_tiles *dst,
+		const struct wlr_damage_ring_tiles *src) {
+	if (dst->width == src->width && dst->height == src->height) {
+		// The common case, written so that it gets vectorized
+		size_t len = tiles_len(dst);
+		for (size_t i = 0; i < len; i++) {
+			dst->bits[i] |= src->bits[i];
+		}
+		return;
+	}
+
+	// Only happens after an allocation failure
+	size_t dst_stride = tiles_stride(dst), src_stride = tiles_stride(src);
+	size_t stride = dst_stride < src_stride ? dst_stride : src_stride;
+	int height = dst->height < src->height ? dst->height : src->height;
+	for (int y = 0; y < height; y++) {
+		for (size_t i = 0; i < stride; i++) {
+			dst->bits[y * dst_stride + i] |= src->bits[y * src_stride + i];
+		}
+	}
+}
+
+static void tiles_copy(struct wlr_damage_ring_tiles *dst,
+		const struct wlr_damage_ring_tiles *src) {
+	tiles_clear(dst);
+	tiles_or(dst, src);
+}
+
+static void tiles_add_box(struct wlr_damage_ring_tiles *tiles, int tile_size,
+		int x1, int y1, int x2, int y2) {
+	// Damage outside of the grid doesn't cover any known buffer
+	int tx1 = x1 > 0 ? x1 / tile_size : 0;
+	int ty1 = y1 > 0 ? y1 / tile_size : 0;
+	int tx2 = x2 > 0 ? (x2 + tile_size - 1) / tile_size : 0;
+	int ty2 = y2 > 0 ? (y2 + tile_size - 1) / tile_size : 0;
+	tx2 = tx2 < tiles->width ? tx2 : tiles->width;
+	ty2 = ty2 < tiles->height ? ty2 : tiles->height;
+	if (tx1 >= tx2 || ty1 >= ty2) {
+		return;
+	}
+
+	int w1 = tx1 / 64, w2 = (tx2 - 1) / 64;
+	uint64_t first_mask = UINT64_MAX << (tx1 % 64);
+	uint64_t last_mask = UINT64_MAX >> (63 - (tx2 - 1) % 64);
+	size_t stride = tiles_stride(tiles);
+	for (int y = ty1; y < ty2; y++) {
+		uint64_t *row = &tiles->bits[y * stride];
+		if (w1 == w2) {
+			row[w1] |= first_mask & last_mask;
+			continue;
+		}
+		row[w1] |= first_mask;
+		for (int w = w1 + 1; w < w2; w++) {
+			row[w] = UINT64_MAX;
+		}
+		row[w2] |= last_mask;
+	}
+}
+
+/**
+ * Returns the number of damaged tiles among the first width x height ones.
+ */
+static size_t tiles_count(const struct wlr_damage_ring_tiles *tiles,
+		int width, int height) {
+	size_t stride = tiles_stride(tiles);
+	size_t full_words = width / 64;
+	uint64_t last_mask = width % 64 != 0 ? UINT64_MAX >> (64 - width % 64) : 0;
+
+	size_t count = 0;
+	for (int y = 0; y < height; y++) {
+		const uint64_t *row = &tiles->bits[y * stride];
+		for (size_t w = 0; w < full_words; w++) {
+			count += __builtin_popcountll(row[w]);
+		}
+		if (last_mask != 0) {
+			count += __builtin_popcountll(row[full_words] & last_mask);
+		}
+	}
+	return count;
+}
+
+/**
+ * Converts the damaged tiles to a region, clipped to width x height pixels.
+ */
+static void tiles_to_region(const struct wlr_damage_ring_tiles *tiles,
+		int tile_size, int width, int height, pixman_region32_t *region) {
+	int tiles_width = (width + tile_size - 1) / tile_size;
+	int tiles_height = (height + tile_size - 1) / tile_size;
+	tiles_width = tiles_width < tiles->width ? tiles_width : tiles->width;
+	tiles_height = tiles_height < tiles->height ? tiles_height : tiles->height;
+
+	pixman_region32_clear(region);
+
+	size_t count = tiles_count(tiles, tiles_width, tiles_height);
+	if (count == 0) {
+		return;
+	} else if (count == (size_t)tiles_width * tiles_height) {
+		pixman_region32_union_rect(region, region, 0, 0, width, height);
+		return;
+	}
+
+	// There is at most one run for every two tiles in a row
+	size_t max_boxes = (size_t)tiles_height * ((tiles_width + 1) / 2);
+	pixman_box32_t *boxes = malloc(max_boxes * sizeof(*boxes));
+	if (boxes == NULL) {
+		pixman_region32_union_rect(region, region, 0, 0, width, height);
+		return;
+	}
+
+	size_t stride = tiles_stride(tiles);
+	int n = 0;
+	for (int y = 0; y < tiles_height; y++) {
+		const uint64_t *row = &tiles->bits[y * stride];
+		int x = 0;
+		while (x < tiles_width) {
+			if (row[x / 64] == 0) {
+				x = (x / 64 + 1) * 64;
+				continue;
+			}
+			if (!(row[x / 64] & (UINT64_C(1) << (x % 64)))) {
+				x++;
+				continue;
+			}
+
+			int start = x;
+			while (x < tiles_width && (row[x / 64] & (UINT64_C(1) << (x % 64)))) {
+				x++;
+			}
+
+			int y2 = (y + 1) * tile_size;
+			int x2 = x * tile_size;
+			boxes[n++] = (pixman_box32_t){
+				.x1 = start * tile_size,
+				.y1 = y * tile_size,
+				.x2 = x2 < width ? x2 : width,
+				.y2 = y2 < height ? y2 : height,
+			};
+		}
+	}
+
+	// Runs with the same extents on consecutive rows are coalesced here
+	pixman_region32_fini(region);
+	if (!pixman_region32_init_rects(region, boxes, n)) {
+		pixman_region32_fini(region);
+		pixman_region32_init_rect(region, 0, 0, width, height);
+	}
+	free(boxes);
+}
+
 static void buffer_destroy(struct wlr_damage_ring_buffer *entry) {
 	wl_list_remove(&entry->destroy.link);
 	wl_list_remove(&entry->link);
 	pixman_region32_fini(&entry->damage);
+	tiles_finish(&entry->tiles);
 	free(entry);
 }
 
 void wlr_damage_ring_finish(struct wlr_damage_ring *ring) {
 	pixman_region32_fini(&ring->current);
+	tiles_finish(&ring->current_tiles);
+	tiles_finish(&ring->accum_tiles);
+	struct wlr_damage_ring_buffer *entry, *tmp_entry;
+	wl_list_for_each_safe(entry, tmp_entry, &ring->buffers, link) {
+		buffer_destroy(entry);
+	}
+}
+
+void wlr_damage_ring_set_tile_size(struct wlr_damage_ring *ring, int tile_size) {
+	if (tile_size < 0) {
+		tile_size = 0;
+	}
+	if (ring->tile_size == tile_size) {
+		return;
+	}
+
+	// Buffers will be damaged fully when they come back
 	struct wlr_damage_ring_buffer *entry, *tmp_entry;
 	wl_list_for_each_safe(entry, tmp_entry, &ring->buffers, link) {
 		buffer_destroy(entry);
 	}
+	pixman_region32_clear(&ring->current);
+	tiles_finish(&ring->current_tiles);
+	tiles_finish(&ring->accum_tiles);
+
+	ring->tile_size = tile_size;
+}
+
+void wlr_damage_ring_get_current(const struct wlr_damage_ring *ring,
+		pixman_region32_t *damage) {
+	if (ring->tile_size == 0) {
+		pixman_region32_copy(damage, &ring->current);
+		return;
+	}
+
+	const struct wlr_damage_ring_tiles *tiles = &ring->current_tiles;
+	tiles_to_region(tiles, ring->tile_size, tiles->width * ring->tile_size,
+		tiles->height * ring->tile_size, damage);
 }
 
 void wlr_damage_ring_add(struct wlr_damage_ring *ring,
 		const pixman_region32_t *damage) {
-	pixman_region32_union(&ring->current, &ring->current, damage);
+	if (ring->tile_size == 0) {
+		pixman_region32_union(&ring->current, &ring->current, damage);
+		return;
+	}
+
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		tiles_add_box(&ring->current_tiles, ring->tile_size,
+			rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+	}
 }
 
 void wlr_damage_ring_add_box(struct wlr_damage_ring *ring,
 		const struct wlr_box *box) {
+	if (ring->tile_size != 0) {
+		tiles_add_box(&ring->current_tiles, ring->tile_size,
+			box->x, box->y, box->x + box->width, box->y + box->height);
+		return;
+	}
+
 	pixman_region32_union_rect(&ring->current,
 		&ring->current, box->x, box->y,
 		box->width, box->height);
@@ -51,32 +314,283 @@ void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring) {
 		height = height < entry->buffer->height ? entry->buffer->height : height;
 	}
 
+	if (ring->tile_size != 0) {
+		tiles_add_box(&ring->current_tiles, ring->tile_size, 0, 0, width, height);
+		return;
+	}
+
 	pixman_region32_union_rect(&ring->current,
 		&ring->current, 0, 0, width, height);
 }
 
 static void entry_squash_damage(struct wlr_damage_ring_buffer *entry) {
-	pixman_region32_t *prev;
-	if (entry->link.prev == &entry->ring->buffers) {
-		// this entry is the first in the list
-		prev = &entry->ring->current;
-	} else {
-		struct wlr_damage_ring_buffer *last =
-			wl_container_of(entry->link.prev, last, link);
-		prev = &last->damage;
+	struct wlr_damage_ring *ring = entry->ring;
+	struct wlr_damage_ring_buffer *last = NULL;
+	if (entry->link.prev != &ring->buffers) {
+		last = wl_container_of(entry->link.prev, last, link);
+	}
+
+	if (ring->tile_size != 0) {
+		tiles_or(last != NULL ? &last->tiles : &ring->current_tiles, &entry->tiles);
+		return;
 	}
 
+	// If this entry is the first in the list, squash into the current damage
+	pixman_region32_t *prev = last != NULL ? &last->damage : &ring->current;
 	pixman_region32_union(prev, prev, &entry->damage);
 }
 
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static pixman_box32_t box_union(const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	return (pixman_box32_t){
+		.x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+		.y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+		.x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+		.y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+	};
+}
+
+static int64_t box_intersection_area(const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	int32_t x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+	int32_t y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+	int32_t x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+	int32_t y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+	if (x1 >= x2 || y1 >= y2) {
+		return 0;
+	}
+	return (int64_t)(x2 - x1) * (y2 - y1);
+}
+
+static bool box_contains(const pixman_box32_t *outer,
+		const pixman_box32_t *inner) {
+	return inner->x1 >= outer->x1 && inner->y1 >= outer->y1 &&
+		inner->x2 <= outer->x2 && inner->y2 <= outer->y2;
+}
+
+/**
+ * Returns the cost of drawing a region: its area, plus the per-rectangle
+ * overhead of each of its y-x banded rectangles.
+ */
+static int64_t region_cost(const pixman_region32_t *region, uint32_t rect_cost) {
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &n_rects);
+	int64_t cost = (int64_t)n_rects * rect_cost;
+	for (int i = 0; i < n_rects; i++) {
+		cost += box_area(&rects[i]);
+	}
+	return cost;
+}
+
+/**
+ * Merges the cheapest pair of boxes, i.e. the one adding the least area, and
+ * drops the boxes swallowed by the result. Returns the new number of boxes.
+ */
+static int merge_cheapest_boxes(pixman_box32_t *boxes, int n) {
+	int best_i = 0, best_j = 1;
+	int64_t best_delta = INT64_MAX;
+	for (int i = 0; i < n; i++) {
+		for (int j = i + 1; j < n; j++) {
+			pixman_box32_t merged = box_union(&boxes[i], &boxes[j]);
+			int64_t delta = box_area(&merged) - box_area(&boxes[i]) -
+				box_area(&boxes[j]) + box_intersection_area(&boxes[i], &boxes[j]);
+			if (delta < best_delta) {
+				best_delta = delta;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+
+	boxes[best_i] = box_union(&boxes[best_i], &boxes[best_j]);
+	boxes[best_j] = boxes[--n];
+
+	for (int i = 0; i < n; i++) {
+		if (i != best_i && box_contains(&boxes[best_i], &boxes[i])) {
+			boxes[i] = boxes[--n];
+			if (best_i == n) {
+				best_i = i;
+			}
+			i--;
+		}
+	}
+	return n;
+}
+
+/**
+ * Merges rectangles of the damage region as long as it lowers the cost of
+ * drawing it, and until the region has at most WLR_DAMAGE_RING_MAX_RECTS
+ * rectangles. Pairs are merged greedily, cheapest first. The cost is measured
+ * on the banded region which is eventually drawn, since overlapping or
+ * staggered boxes are split again by pixman.
+ */
+static void simplify_damage(pixman_region32_t *damage, uint32_t rect_cost) {
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &n_rects);
+	if (n_rects <= 1) {
+		return;
+	}
+
+	pixman_box32_t *boxes = malloc(2 * n_rects * sizeof(*boxes));
+	if (boxes == NULL) {
+		// Fall back to the bounding box
+		pixman_box32_t extents = *pixman_region32_extents(damage);
+		pixman_region32_fini(damage);
+		pixman_region32_init_with_extents(damage, &extents);
+		return;
+	}
+	pixman_box32_t *next_boxes = boxes + n_rects;
+	memcpy(boxes, rects, n_rects * sizeof(*boxes));
+	int n = n_rects;
+
+	// Rectangles are sorted in y-x bands, so neighbours in the list are
+	// close to each other: merge them pairwise to bound the cost of the
+	// search below
+	while (n > WLR_DAMAGE_RING_MAX_INPUT_RECTS) {
+		int j = 0;
+		for (int i = 0; i < n; i += 2) {
+			boxes[j++] = i + 1 < n ? box_union(&boxes[i], &boxes[i + 1]) : boxes[i];
+		}
+		n = j;
+	}
+
+	pixman_region32_t region;
+	if (n < n_rects) {
+		pixman_region32_init_rects(&region, boxes, n);
+	} else {
+		pixman_region32_init(&region);
+		pixman_region32_copy(&region, damage);
+	}
+	int64_t cost = region_cost(&region, rect_cost);
+
+	while (n > 1) {
+		memcpy(next_boxes, boxes, n * sizeof(*boxes));
+		int next_n = merge_cheapest_boxes(next_boxes, n);
+
+		pixman_region32_t next_region;
+		pixman_region32_init_rects(&next_region, next_boxes, next_n);
+		int64_t next_cost = region_cost(&next_region, rect_cost);
+
+		if (next_cost >= cost &&
+				pixman_region32_n_rects(&region) <= WLR_DAMAGE_RING_MAX_RECTS) {
+			pixman_region32_fini(&next_region);
+			break;
+		}
+
+		pixman_region32_fini(&region);
+		region = next_region;
+		cost = next_cost;
+		memcpy(boxes, next_boxes, next_n * sizeof(*boxes));
+		n = next_n;
+	}
+
+	// A single box is a single rectangle, so the loop above always ends
+	// within the limit
+	assert(pixman_region32_n_rects(&region) <= WLR_DAMAGE_RING_MAX_RECTS);
+	pixman_region32_fini(damage);
+	*damage = region;
+	free(boxes);
+}
+
 static void buffer_handle_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_damage_ring_buffer *entry = wl_container_of(listener, entry, destroy);
 	entry_squash_damage(entry);
 	buffer_destroy(entry);
 }
 
+/**
+ * Grows all the tile grids of the ring to cover the buffer.
+ */
+static bool ring_reserve_tiles(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer) {
+	int width = (buffer->width + ring->tile_size - 1) / ring->tile_size;
+	int height = (buffer->height + ring->tile_size - 1) / ring->tile_size;
+
+	if (!tiles_reserve(&ring->current_tiles, width, height) ||
+			!tiles_reserve(&ring->accum_tiles, width, height)) {
+		return false;
+	}
+
+	struct wlr_damage_ring_buffer *entry;
+	wl_list_for_each(entry, &ring->buffers, link) {
+		if (!tiles_reserve(&entry->tiles, width, height)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void rotate_buffer_tiles(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer, pixman_region32_t *damage) {
+	if (!ring_reserve_tiles(ring, buffer)) {
+		goto whole;
+	}
+
+	struct wlr_damage_ring_tiles *accum = &ring->accum_tiles;
+	tiles_copy(accum, &ring->current_tiles);
+
+	struct wlr_damage_ring_buffer *entry;
+	wl_list_for_each(entry, &ring->buffers, link) {
+		if (entry->buffer != buffer) {
+			tiles_or(accum, &entry->tiles);
+			continue;
+		}
+
+		tiles_to_region(accum, ring->tile_size, buffer->width, buffer->height, damage);
+		simplify_damage(damage, ring->rect_cost);
+
+		// rotate, the entry takes over the current tiles and vice-versa
+		entry_squash_damage(entry);
+		struct wlr_damage_ring_tiles tiles = entry->tiles;
+		entry->tiles = ring->current_tiles;
+		ring->current_tiles = tiles;
+		tiles_clear(&ring->current_tiles);
+
+		wl_list_remove(&entry->link);
+		wl_list_insert(&ring->buffers, &entry->link);
+		return;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		goto whole;
+	}
+
+	struct wlr_damage_ring_tiles *current = &ring->current_tiles;
+	if (!tiles_init(&entry->tiles, current->width, current->height)) {
+		free(entry);
+		goto whole;
+	}
+
+	pixman_region32_init(&entry->damage);
+	struct wlr_damage_ring_tiles tiles = entry->tiles;
+	entry->tiles = *current;
+	*current = tiles;
+
+	wl_list_insert(&ring->buffers, &entry->link);
+	entry->buffer = buffer;
+	entry->ring = ring;
+
+	entry->destroy.notify = buffer_handle_destroy;
+	wl_signal_add(&buffer->events.destroy, &entry->destroy);
+
+whole:
+	pixman_region32_clear(damage);
+	pixman_region32_union_rect(damage, damage,
+		0, 0, buffer->width, buffer->height);
+}
+
 void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
 		struct wlr_buffer *buffer, pixman_region32_t *damage) {
+	if (ring->tile_size != 0) {
+		rotate_buffer_tiles(ring, buffer, damage);
+		return;
+	}
+
 	pixman_region32_copy(damage, &ring->current);
 
 	struct wlr_damage_ring_buffer *entry;
@@ -88,15 +602,7 @@ void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
 
 		pixman_region32_intersect_rect(damage, damage, 0, 0, buffer->width, buffer->height);
 
-		// Check the number of rectangles
-		int n_rects = pixman_region32_n_rects(damage);
-		if (n_rects > WLR_DAMAGE_RING_MAX_RECTS) {
-			pixman_box32_t *extents = pixman_region32_extents(damage);
-			pixman_region32_union_rect(damage, damage,
-				extents->x1, extents->y1,
-				extents->x2 - extents->x1,
-				extents->y2 - extents->y1);
-		}
+		simplify_damage(damage, ring->rect_cost);
 
 		// rotate
 		entry_squash_damage(entry);
@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_frame_scheduler.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "util/time.h"
+
+#define DEFAULT_SAFETY_MARGIN 1000000 // 1ms
+// Number of frames sent right away after a missed vblank
+#define FALLBACK_FRAMES 60
+
+static void scheduler_send_frame(struct wlr_frame_scheduler *scheduler) {
+	scheduler->frame_queued = false;
+	wl_signal_emit_mutable(&scheduler->events.frame, NULL);
+}
+
+static int handle_timer(void *data) {
+	struct wlr_frame_scheduler *scheduler = data;
+	if (scheduler->frame_queued) {
+		scheduler_send_frame(scheduler);
+	}
+	return 0;
+}
+
+static int64_t predict_duration(struct wlr_frame_scheduler *scheduler) {
+	if (scheduler->durations_len == 0) {
+		return -1;
+	}
+
+	// Assume the worst recent frame, a missed vblank costs more than some
+	// latency
+	int64_t max = 0;
+	for (size_t i = 0; i < scheduler->durations_len; i++) {
+		if (scheduler->durations[i] > max) {
+			max = scheduler->durations[i];
+		}
+	}
+	return max;
+}
+
+static void handle_output_frame(struct wl_listener *listener, void *data) {
+	struct wlr_frame_scheduler *scheduler =
+		wl_container_of(listener, scheduler, output_frame);
+	struct wlr_output *output = scheduler->output;
+
+	if (scheduler->frame_queued) {
+		return;
+	}
+	scheduler->target_vblank = 0;
+
+	if (scheduler->fallback_frames > 0) {
+		scheduler->fallback_frames--;
+		scheduler_send_frame(scheduler);
+		return;
+	}
+
+	// With adaptive sync, the display waits for the frame
+	int64_t duration = predict_duration(scheduler);
+	if (duration < 0 || scheduler->refresh == 0 || scheduler->last_present == 0 ||
+			output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		scheduler_send_frame(scheduler);
+		return;
+	}
+
+	// If the output has been idle, the vblank phase is unknown
+	int64_t now = get_current_time_nsec();
+	int64_t next_vblank = scheduler->last_present + scheduler->refresh;
+	if (next_vblank <= now) {
+		scheduler_send_frame(scheduler);
+		return;
+	}
+
+	// Event loop timers have a millisecond granularity, round down
+	int64_t deadline = next_vblank - duration - scheduler->safety_margin;
+	int delay_ms = (deadline - now) / 1000000;
+	if (delay_ms <= 0) {
+		scheduler_send_frame(scheduler);
+		return;
+	}
+
+	scheduler->target_vblank = next_vblank;
+	scheduler->frame_queued = true;
+	wl_event_source_timer_update(scheduler->timer, delay_ms);
+}
+
+static void record_duration(struct wlr_frame_scheduler *scheduler,
+		int64_t duration) {
+	scheduler->durations[scheduler->durations_index] = duration;
+	scheduler->durations_index =
+		(scheduler->durations_index + 1) % WLR_FRAME_SCHEDULER_HISTORY_LEN;
+	if (scheduler->durations_len < WLR_FRAME_SCHEDULER_HISTORY_LEN) {
+		scheduler->durations_len++;
+	}
+}
+
+static void finish_render(struct wlr_frame_scheduler *scheduler) {
+	if (!scheduler->render_pending) {
+		return;
+	}
+	scheduler->render_pending = false;
+
+	int64_t duration = scheduler->cpu_duration;
+	if (scheduler->render_timer != NULL) {
+		int gpu_duration = wlr_render_timer_get_duration_ns(scheduler->render_timer);
+		if (gpu_duration > 0) {
+			duration += gpu_duration;
+		}
+		scheduler->render_timer = NULL;
+	}
+	record_duration(scheduler, duration);
+}
+
+static void handle_output_present(struct wl_listener *listener, void *data) {
+	struct wlr_frame_scheduler *scheduler =
+		wl_container_of(listener, scheduler, output_present);
+	struct wlr_output_event_present *event = data;
+
+	bool rendered = scheduler->render_pending &&
+		scheduler->commit_seq == event->commit_seq;
+	if (rendered) {
+		finish_render(scheduler);
+	}
+
+	if (!event->presented) {
+		return;
+	}
+
+	scheduler->last_present = timespec_to_nsec(&event->when);
+	if (event->refresh > 0) {
+		scheduler->refresh = event->refresh;
+	} else if (scheduler->output->refresh > 0) {
+		scheduler->refresh = 1000000000000ll / scheduler->output->refresh;
+	} else {
+		scheduler->refresh = 0;
+	}
+
+	// Leave some slack for inaccurate timestamps
+	if (rendered && scheduler->commit_target != 0 &&
+			scheduler->last_present > scheduler->commit_target + scheduler->refresh / 2) {
+		wlr_log(WLR_DEBUG, "Frame scheduled for %s missed its vblank, "
+			"sending the next frames right away", scheduler->output->name);
+		scheduler->fallback_frames = FALLBACK_FRAMES;
+	}
+}
+
+void wlr_frame_scheduler_destroy(struct wlr_frame_scheduler *scheduler) {
+	if (scheduler == NULL) {
+		return;
+	}
+
+	wl_signal_emit_mutable(&scheduler->events.destroy, NULL);
+
+	assert(wl_list_empty(&scheduler->events.frame.listener_list));
+	assert(wl_list_empty(&scheduler->events.destroy.listener_list));
+
+	wl_list_remove(&scheduler->output_frame.link);
+	wl_list_remove(&scheduler->output_present.link);
+	wl_list_remove(&scheduler->output_destroy.link);
+	wl_event_source_remove(scheduler->timer);
+	free(scheduler);
+}
+
+static void handle_output_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_frame_scheduler *scheduler =
+		wl_container_of(listener, scheduler, output_destroy);
+	wlr_frame_scheduler_destroy(scheduler);
+}
+
+struct wlr_frame_scheduler *wlr_frame_scheduler_create(struct wlr_output *output) {
+	struct wlr_frame_scheduler *scheduler = calloc(1, sizeof(*scheduler));
+	if (scheduler == NULL) {
+		return NULL;
+	}
+
+	scheduler->timer = wl_event_loop_add_timer(output->event_loop,
+		handle_timer, scheduler);
+	if (scheduler->timer == NULL) {
+		free(scheduler);
+		return NULL;
+	}
+
+	scheduler->output = output;
+	scheduler->safety_margin = DEFAULT_SAFETY_MARGIN;
+	wl_signal_init(&scheduler->events.frame);
+	wl_signal_init(&scheduler->events.destroy);
+
+	scheduler->output_frame.notify = handle_output_frame;
+	wl_signal_add(&output->events.frame, &scheduler->output_frame);
+	scheduler->output_present.notify = handle_output_present;
+	wl_signal_add(&output->events.present, &scheduler->output_present);
+	scheduler->output_destroy.notify = handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &scheduler->output_destroy);
+
+	return scheduler;
+}
+
+void wlr_frame_scheduler_inform_render(struct wlr_frame_scheduler *scheduler,
+		int64_t cpu_duration, struct wlr_render_timer *render_timer) {
+	// The previous frame was never presented, its GPU time may be missing
+	finish_render(scheduler);
+
+	scheduler->render_pending = true;
+	scheduler->render_timer = render_timer;
+	scheduler->cpu_duration = cpu_duration;
+	scheduler->commit_seq = scheduler->output->commit_seq;
+	scheduler->commit_target = scheduler->target_vblank;
+	scheduler->target_vblank = 0;
+}
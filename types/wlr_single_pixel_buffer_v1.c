@@ -8,15 +8,6 @@
 
 #define SINGLE_PIXEL_MANAGER_VERSION 1
 
-struct wlr_single_pixel_buffer_v1 {
-	struct wlr_buffer base;
-	struct wl_resource *resource;
-	uint32_t r, g, b, a;
-	uint8_t argb8888[4]; // packed little-endian DRM_FORMAT_ARGB8888
-
-	struct wl_listener release;
-};
-
 static void destroy_resource(struct wl_client *client,
 		struct wl_resource *resource) {
 	wl_resource_destroy(resource);
@@ -86,6 +77,16 @@ static const struct wlr_buffer_impl buffer_impl = {
 	.end_data_ptr_access = buffer_end_data_ptr_access,
 };
 
+struct wlr_single_pixel_buffer_v1 *wlr_single_pixel_buffer_v1_try_from_buffer(
+		struct wlr_buffer *buffer) {
+	if (buffer->impl != &buffer_impl) {
+		return NULL;
+	}
+	struct wlr_single_pixel_buffer_v1 *single_pixel_buffer =
+		wl_container_of(buffer, single_pixel_buffer, base);
+	return single_pixel_buffer;
+}
+
 static void buffer_handle_resource_destroy(struct wl_resource *resource) {
 	struct wlr_single_pixel_buffer_v1 *buffer = single_pixel_buffer_v1_from_resource(resource);
 	buffer->resource = NULL;
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wlr/util/log.h>
@@ -36,3 +37,24 @@ size_t env_parse_switch(const char *option, const char **switches) {
 	wlr_log(WLR_ERROR, "Unknown %s option: %s", option, env);
 	return 0;
 }
+
+long env_parse_long(const char *option, long min, long max, long default_value) {
+	const char *env = getenv(option);
+	if (env) {
+		wlr_log(WLR_INFO, "Loading %s option: %s", option, env);
+	} else {
+		return default_value;
+	}
+
+	char *end;
+	errno = 0;
+	long value = strtol(env, &end, 10);
+	if (*env == '\0' || *end != '\0' || errno != 0 ||
+			value < min || value > max) {
+		wlr_log(WLR_ERROR, "Invalid %s option: %s (expected an integer "
+			"between %ld and %ld)", option, env, min, max);
+		return default_value;
+	}
+
+	return value;
+}
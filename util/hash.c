@@ -0,0 +1,11 @@
+#include "util/hash.h"
+
+uint64_t hash_fnv1a(const void *data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325;
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}